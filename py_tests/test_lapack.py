@@ -19,3 +19,36 @@ print(B.UFactor())
 print(B.PFactor())
 
 
+# the same factors without copies
+L, U, P = B.LView(), B.UView(), B.PView()
+print(L.shape, L.lower, L.unit, U[0, 3])
+print(L.Dense())
+print(P.Indices())
+
+# A^{-1} x through the views: x := U^{-1} L^{-1} P^T x
+x = Vector(4)
+for i in range(4):
+    x[i] = i
+P.Apply(x, transposed=True)
+L.Solve(x)
+U.Solve(x)
+print(x)
+
+# right hand sides of the wrong height are rejected instead of read past their end
+for rhs in (Vector(3), Matrix(5, 2)):
+    try:
+        B.Solve(rhs)
+    except ValueError as err:
+        print("rejected:", err)
+
+# Inverse works on a copy: the views still reference the factors afterwards
+Ainv = B.Inverse()
+y = Vector(4)
+for i in range(4):
+    y[i] = i
+P.Apply(y, transposed=True)
+L.Solve(y)
+U.Solve(y)
+assert all(abs(y[i] - x[i]) < 1e-12 for i in range(4)), "views changed by Inverse()"
+assert abs(L[2, 1] - B.LFactor()[2, 1]) < 1e-15
+print("views after Inverse():", y)
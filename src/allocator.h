@@ -0,0 +1,162 @@
+#ifndef FILE_ALLOCATOR_H
+#define FILE_ALLOCATOR_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+
+namespace Neo_CLA{
+
+// Allocators for the storage of Vector and Matrix (template parameter ALLOC).
+// They are stateless: allocate(n) returns memory for n objects of type T, which is given
+// back with deallocate(p, n). Construction and destruction of the elements is done by the containers.
+
+constexpr size_t storage_alignment = 64; // cache line, and the width of an AVX-512 register
+
+
+// every block is aligned to 64 bytes, so SIMD kernels can use aligned loads
+template <typename T>
+class AlignedAllocator
+{
+ public:
+  typedef T value_type;
+
+  static T * allocate(size_t n)
+  {
+    return static_cast<T*> (::operator new[](n*sizeof(T), std::align_val_t(storage_alignment)));
+  }
+
+  static void deallocate(T * p, size_t)
+  {
+    ::operator delete[](p, std::align_val_t(storage_alignment));
+  }
+};
+
+
+// Aligned blocks in power-of-two size classes, with a free list per class and thread.
+// Temporaries of the same size (e.g. the vectors of one time step) get the memory of their
+// predecessors instead of going through malloc. At most max_cached blocks are kept per class,
+// blocks above max_class_bytes are not pooled.
+class SizeClassPool
+{
+  static constexpr size_t min_class_bytes = 64;
+  static constexpr size_t max_class_bytes = size_t(1) << 27;
+  static constexpr size_t num_classes = 22; // 2^6 ... 2^27 bytes
+  static constexpr size_t max_cached = 8;
+
+  std::vector<void*> freelist_[num_classes];
+
+  // trivially destructible, so it can still be read after the pool of the thread is gone
+  static bool & Destroyed()
+  {
+    thread_local bool destroyed = false;
+    return destroyed;
+  }
+
+  static void * AllocateRaw(size_t bytes)
+  {
+    return ::operator new(bytes, std::align_val_t(storage_alignment));
+  }
+
+  static void FreeRaw(void * p)
+  {
+    ::operator delete(p, std::align_val_t(storage_alignment));
+  }
+
+  // index of the smallest class holding bytes
+  static size_t ClassOf(size_t bytes)
+  {
+    size_t cls = 0;
+    for (size_t size = min_class_bytes; size < bytes; size *= 2)
+      cls++;
+    return cls;
+  }
+
+ public:
+  ~SizeClassPool()
+  {
+    Release();
+    Destroyed() = true;
+  }
+
+  static SizeClassPool & Local()
+  {
+    thread_local SizeClassPool pool;
+    return pool;
+  }
+
+  static void * Allocate(size_t bytes)
+  {
+    if (bytes > max_class_bytes || Destroyed())
+      return AllocateRaw(bytes);
+
+    size_t cls = ClassOf(bytes);
+    std::vector<void*> & list = Local().freelist_[cls];
+    if (list.empty())
+      return AllocateRaw(min_class_bytes << cls);
+
+    void * p = list.back();
+    list.pop_back();
+    return p;
+  }
+
+  // the block goes to the pool of the calling thread, which is not necessarily the one that allocated it
+  static void Deallocate(void * p, size_t bytes)
+  {
+    if (!p) return;
+    if (bytes > max_class_bytes || Destroyed())
+    {
+      FreeRaw(p);
+      return;
+    }
+
+    std::vector<void*> & list = Local().freelist_[ClassOf(bytes)];
+    if (list.size() < max_cached)
+      list.push_back(p);
+    else
+      FreeRaw(p);
+  }
+
+  // gives all cached blocks of the calling thread back to the system
+  void Release()
+  {
+    for (auto & list : freelist_)
+    {
+      for (void * p : list)
+        FreeRaw(p);
+      list.clear();
+    }
+  }
+
+  // number of cached blocks of the calling thread
+  size_t Cached() const
+  {
+    size_t cnt = 0;
+    for (auto & list : freelist_)
+      cnt += list.size();
+    return cnt;
+  }
+};
+
+
+// allocator for short-lived temporaries, e.g. Vector<double, PoolAllocator<double>>
+template <typename T>
+class PoolAllocator
+{
+ public:
+  typedef T value_type;
+
+  static T * allocate(size_t n)
+  {
+    return static_cast<T*> (SizeClassPool::Allocate(n*sizeof(T)));
+  }
+
+  static void deallocate(T * p, size_t n)
+  {
+    SizeClassPool::Deallocate(p, n*sizeof(T));
+  }
+};
+
+} // namespace
+#endif
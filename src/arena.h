@@ -0,0 +1,98 @@
+#ifndef FILE_ARENA_H
+#define FILE_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+
+
+namespace Neo_CLA{
+
+// 64-byte aligned memory for packed blocks
+class AlignedBuffer
+{
+  double * data_;
+
+ public:
+  AlignedBuffer(size_t size)
+    : data_(static_cast<double*> (::operator new[](size*sizeof(double), std::align_val_t(64)))) {;}
+
+  AlignedBuffer(const AlignedBuffer &) = delete;
+  AlignedBuffer & operator= (const AlignedBuffer &) = delete;
+
+  ~AlignedBuffer() { ::operator delete[](data_, std::align_val_t(64)); }
+
+  double * Data() { return data_; }
+};
+
+
+// Scratch memory of one thread, shared by all kernels running on it.
+// It grows on demand and is kept between calls, so block sizes are not limited
+// by the stack size of the threads and nothing is allocated per call.
+// The arenas of the workers are freed when the task pool stops (the threads end).
+class PackingArena
+{
+  std::unique_ptr<AlignedBuffer> buffer_;
+  size_t size_ = 0;
+  bool leased_ = false;
+
+  friend class ArenaLease;
+
+ public:
+  static PackingArena & Local()
+  {
+    thread_local PackingArena arena;
+    return arena;
+  }
+
+  // frees the memory (unless a kernel is using it right now)
+  void Release()
+  {
+    if (leased_) return;
+    buffer_.reset();
+    size_ = 0;
+  }
+
+  size_t Size() const { return size_; }
+};
+
+
+// at least size doubles from the arena of the calling thread, for the lifetime of the lease;
+// if the arena is already leased (a kernel called from within a kernel), the memory is allocated separately
+class ArenaLease
+{
+  PackingArena & arena_;
+  std::unique_ptr<AlignedBuffer> own_;
+  double * data_;
+
+ public:
+  ArenaLease(size_t size)
+    : arena_(PackingArena::Local())
+  {
+    if (arena_.leased_)
+    {
+      own_ = std::make_unique<AlignedBuffer>(size);
+      data_ = own_->Data();
+      return;
+    }
+
+    if (size > arena_.size_)
+    {
+      arena_.buffer_.reset(); // free first, the old contents are not needed
+      arena_.buffer_ = std::make_unique<AlignedBuffer>(size);
+      arena_.size_ = size;
+    }
+    arena_.leased_ = true;
+    data_ = arena_.buffer_->Data();
+  }
+
+  ArenaLease(const ArenaLease &) = delete;
+  ArenaLease & operator= (const ArenaLease &) = delete;
+
+  ~ArenaLease() { if (!own_) arena_.leased_ = false; }
+
+  double * Data() { return data_; }
+};
+
+} // namespace
+#endif
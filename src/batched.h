@@ -0,0 +1,338 @@
+#ifndef FILE_BATCHED_H
+#define FILE_BATCHED_H
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "allocator.h"
+#include "expression.h"
+#include "matrix.h"
+#include "simd.h"
+#include "taskpool.h"
+
+
+namespace Neo_CLA{
+
+// Many small matrices of the same shape, e.g. the element matrices of a simulation, are processed
+// together: the items of a batch are interleaved, so that one SIMD packet holds the same entry of
+// batch_lanes consecutive items. Every kernel then works on batch_lanes matrices at once, without
+// any per-item call overhead, shuffles or branches, and the blocks of items are spread over the task pool.
+
+constexpr int batch_lanes = 4;
+typedef Neo_HPC::SIMD<double, batch_lanes> BatchPacket;
+
+
+// Size() matrices of shape H x W, stored block by block: block b holds the items
+// b*batch_lanes ... b*batch_lanes+batch_lanes-1, entry (i,j) of all of them in one packet.
+// The unused lanes of the last block are zero (the identity for square matrices, so they can be factored).
+template <int H, int W>
+class MatrixBatch
+{
+  size_t size_;
+  size_t blocks_;
+  double * data_;
+
+ public:
+  static constexpr size_t block_size = H*W*batch_lanes;
+
+  explicit MatrixBatch (size_t size)
+    : size_(size), blocks_((size + batch_lanes - 1) / batch_lanes),
+      data_(AlignedAllocator<double>::allocate(blocks_*block_size))
+  {
+    std::fill_n(data_, blocks_*block_size, 0.0);
+    if constexpr (H == W)
+      for (size_t item = size_; item < blocks_*batch_lanes; item++)
+        for (size_t i = 0; i < H; i++)
+          (*this)(item, i, i) = 1;
+  }
+
+  MatrixBatch (const MatrixBatch & B)
+    : MatrixBatch (B.size_)
+  {
+    std::copy_n(B.data_, blocks_*block_size, data_);
+  }
+
+  MatrixBatch (MatrixBatch && B)
+    : size_(0), blocks_(0), data_(nullptr)
+  {
+    *this = std::move(B);
+  }
+
+  ~MatrixBatch ()
+  {
+    if (data_) AlignedAllocator<double>::deallocate(data_, blocks_*block_size);
+  }
+
+  MatrixBatch & operator= (const MatrixBatch & B)
+  {
+    if (size_ != B.size_)
+      throw std::invalid_argument("batches need to have the same size");
+    std::copy_n(B.data_, blocks_*block_size, data_);
+    return *this;
+  }
+
+  MatrixBatch & operator= (MatrixBatch && B)
+  {
+    std::swap(size_, B.size_);
+    std::swap(blocks_, B.blocks_);
+    std::swap(data_, B.data_);
+    return *this;
+  }
+
+  size_t Size() const { return size_; }
+  size_t Blocks() const { return blocks_; }
+  constexpr size_t height() const { return H; }
+  constexpr size_t width() const { return W; }
+
+  // entry (i,j) of matrix number item
+  double & operator() (size_t item, size_t i, size_t j)
+  {
+    return data_[(item / batch_lanes) * block_size + (i*W + j) * batch_lanes + item % batch_lanes];
+  }
+  double operator() (size_t item, size_t i, size_t j) const
+  {
+    return data_[(item / batch_lanes) * block_size + (i*W + j) * batch_lanes + item % batch_lanes];
+  }
+
+  Mat<H, W> Get (size_t item) const
+  {
+    Mat<H, W> A;
+    for (size_t i = 0; i < H; i++)
+      for (size_t j = 0; j < W; j++)
+        A(i, j) = (*this)(item, i, j);
+    return A;
+  }
+
+  void Set (size_t item, const Mat<H, W> & A)
+  {
+    for (size_t i = 0; i < H; i++)
+      for (size_t j = 0; j < W; j++)
+        (*this)(item, i, j) = A(i, j);
+  }
+
+  // the H*W packets of one block
+  double * Block (size_t block) { return data_ + block*block_size; }
+  const double * Block (size_t block) const { return data_ + block*block_size; }
+};
+
+// vectors of length N, e.g. the right hand sides of the systems of a MatrixBatch<N,N>
+template <int N>
+using VectorBatch = MatrixBatch<N, 1>;
+
+
+// C_i = A_i * B_i for all items i
+template <int H, int K, int W>
+void MultBatch (MatrixBatch<H, W> & C, const MatrixBatch<H, K> & A, const MatrixBatch<K, W> & B)
+{
+  if (A.Size() != B.Size() || A.Size() != C.Size())
+    throw std::invalid_argument("batches need to have the same size for multiplication");
+
+  ParallelBlocks(C.Blocks(), C.block_size, [&](size_t first, size_t next) {
+    for (size_t block = first; block < next; block++)
+    {
+      const double * a = A.Block(block);
+      const double * b = B.Block(block);
+      double * c = C.Block(block);
+
+      for (size_t i = 0; i < H; i++)
+      {
+        // row i of all C_i, kept in registers
+        BatchPacket row[W];
+        for (size_t j = 0; j < W; j++)
+          row[j] = BatchPacket(0.0);
+
+        for (size_t k = 0; k < K; k++)
+        {
+          BatchPacket aik(a + (i*K + k) * batch_lanes);
+          for (size_t j = 0; j < W; j++)
+            row[j] = FMA(aik, BatchPacket(b + (k*W + j) * batch_lanes), row[j]);
+        }
+
+        for (size_t j = 0; j < W; j++)
+          row[j].Store(c + (i*W + j) * batch_lanes);
+      }
+    }
+  });
+}
+
+
+// LU factorization with partial pivoting of all items of a batch of square matrices.
+// Each lane chooses its own pivots: the pivot search keeps the largest modulus and its row in packets,
+// then every lane exchanges its two rows once per column.
+template <int N>
+class LUBatch
+{
+  MatrixBatch<N, N> lu_;  // L (unit diagonal, not stored) and U of P A = L U
+  VectorBatch<N> perm_;   // row i of P A is row perm_(item, i) of A
+
+  void Factor ()
+  {
+    ParallelBlocks(lu_.Blocks(), lu_.block_size, [&](size_t first, size_t next) {
+      for (size_t block = first; block < next; block++)
+      {
+        double * lu = lu_.Block(block);
+        double * perm = perm_.Block(block);
+
+        // the packets of the block in a local copy, so rows of single lanes can be exchanged
+        alignas (64) double a[N][N][batch_lanes];
+        alignas (64) double p[N][batch_lanes];
+        std::copy_n(lu, N*N*batch_lanes, &a[0][0][0]);
+        for (size_t i = 0; i < N; i++)
+          for (size_t l = 0; l < batch_lanes; l++)
+            p[i][l] = double(i);
+
+        auto packet = [&](size_t i, size_t j) { return BatchPacket(&a[i][j][0]); };
+
+        for (size_t k = 0; k < N; k++)
+        {
+          // the row of the entry of largest modulus in column k, lane by lane
+          BatchPacket maxval = Abs(packet(k, k)), maxrow = BatchPacket(double(k));
+          for (size_t i = k+1; i < N; i++)
+          {
+            BatchPacket aik = Abs(packet(i, k));
+            auto larger = aik > maxval;
+            maxval = Select(larger, aik, maxval);
+            maxrow = Select(larger, BatchPacket(double(i)), maxrow);
+          }
+
+          // one row exchange per lane
+          alignas (64) double rows[batch_lanes];
+          maxrow.Store(rows);
+          for (size_t l = 0; l < batch_lanes; l++)
+          {
+            size_t r = size_t(rows[l]);
+            if (r == k) continue;
+            for (size_t j = 0; j < N; j++)
+              std::swap(a[k][j][l], a[r][j][l]);
+            std::swap(p[k][l], p[r][l]);
+          }
+
+          BatchPacket inv = BatchPacket(1.0) / packet(k, k);
+          for (size_t i = k+1; i < N; i++)
+          {
+            BatchPacket lik = packet(i, k) * inv;
+            lik.Store(&a[i][k][0]);
+            for (size_t j = k+1; j < N; j++)
+              (packet(i, j) - lik * packet(k, j)).Store(&a[i][j][0]);
+          }
+        }
+
+        std::copy_n(&a[0][0][0], N*N*batch_lanes, lu);
+        std::copy_n(&p[0][0], N*batch_lanes, perm);
+      }
+    });
+
+    for (size_t item = 0; item < lu_.Size(); item++)
+      for (size_t i = 0; i < N; i++)
+        if (lu_(item, i, i) == 0)
+          throw std::invalid_argument("LUBatch: matrix " + std::to_string(item) + " is singular");
+  }
+
+  static BatchPacket Abs (BatchPacket x)
+  {
+    return Select(x > BatchPacket(0.0), x, BatchPacket(0.0) - x);
+  }
+
+  // x := U^{-1} L^{-1} x for one block, x already permuted
+  static void SolveBlock (const double * lu, BatchPacket * x)
+  {
+    for (size_t i = 1; i < N; i++)
+      for (size_t j = 0; j < i; j++)
+        x[i] = x[i] - BatchPacket(lu + (i*N + j) * batch_lanes) * x[j];
+
+    for (size_t i = N; i-- > 0; )
+    {
+      for (size_t j = i+1; j < N; j++)
+        x[i] = x[i] - BatchPacket(lu + (i*N + j) * batch_lanes) * x[j];
+      x[i] = x[i] / BatchPacket(lu + (i*N + i) * batch_lanes);
+    }
+  }
+
+ public:
+  LUBatch (MatrixBatch<N, N> A)
+    : lu_(std::move(A)), perm_(lu_.Size())
+  {
+    Factor();
+  }
+
+  size_t Size() const { return lu_.Size(); }
+
+  // the factors of all items, entry (item, i, j) as in MatrixBatch
+  const MatrixBatch<N, N> & LU() const { return lu_; }
+  const VectorBatch<N> & Permutation() const { return perm_; }
+
+  // b_i overwritten with A_i^{-1} b_i for all items
+  void Solve (VectorBatch<N> & b) const
+  {
+    if (b.Size() != Size())
+      throw std::invalid_argument("LUBatch.Solve needs one right hand side per matrix");
+
+    ParallelBlocks(lu_.Blocks(), lu_.block_size, [&](size_t first, size_t next) {
+      for (size_t block = first; block < next; block++)
+      {
+        double * rhs = b.Block(block);
+        const double * perm = perm_.Block(block);
+
+        // gather P b, the permutation differs from lane to lane
+        alignas (64) double pb[N * batch_lanes];
+        for (size_t i = 0; i < N; i++)
+          for (size_t l = 0; l < batch_lanes; l++)
+            pb[i * batch_lanes + l] = rhs[size_t(perm[i * batch_lanes + l]) * batch_lanes + l];
+
+        BatchPacket x[N];
+        for (size_t i = 0; i < N; i++)
+          x[i] = BatchPacket(pb + i * batch_lanes);
+
+        SolveBlock(lu_.Block(block), x);
+
+        for (size_t i = 0; i < N; i++)
+          x[i].Store(rhs + i * batch_lanes);
+      }
+    });
+  }
+
+  // the inverses of all items
+  MatrixBatch<N, N> Inverse () const
+  {
+    MatrixBatch<N, N> inv(Size());
+
+    ParallelBlocks(lu_.Blocks(), lu_.block_size, [&](size_t first, size_t next) {
+      for (size_t block = first; block < next; block++)
+      {
+        const double * perm = perm_.Block(block);
+        double * dst = inv.Block(block);
+
+        for (size_t col = 0; col < N; col++)
+        {
+          // column col of P
+          alignas (64) double pe[N * batch_lanes];
+          for (size_t i = 0; i < N * batch_lanes; i++)
+            pe[i] = perm[i] == col ? 1.0 : 0.0;
+
+          BatchPacket x[N];
+          for (size_t i = 0; i < N; i++)
+            x[i] = BatchPacket(pe + i * batch_lanes);
+
+          SolveBlock(lu_.Block(block), x);
+
+          for (size_t i = 0; i < N; i++)
+            x[i].Store(dst + (i*N + col) * batch_lanes);
+        }
+      }
+    });
+    return inv;
+  }
+};
+
+
+// the inverses of all items of a batch of square matrices
+template <int N>
+MatrixBatch<N, N> Inverse (const MatrixBatch<N, N> & A)
+{
+  return LUBatch<N>(A).Inverse();
+}
+
+} // namespace
+#endif
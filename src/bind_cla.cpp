@@ -14,9 +14,60 @@ using namespace Neo_CLA;
 namespace py = pybind11;
 
 
+// calls f with a MatrixView of a writable buffer of doubles, nothing is copied:
+// a vector (with any positive stride) as one column, a matrix with contiguous rows or columns as it is.
+// The distance of rows (columns) must be a positive number of doubles, at least the row (column) length,
+// since the kernels and LAPACK take it as leading dimension; it is not used for an extent of 1.
+template <typename FUNC>
+void WithMatrixView(py::buffer b, const std::string & who, FUNC f)
+{
+  py::buffer_info info = b.request(true);
+  if (info.format != py::format_descriptor<double>::format())
+    throw std::invalid_argument(who + " needs a buffer of doubles");
+
+  double * data = static_cast<double*> (info.ptr);
+  const py::ssize_t d = sizeof(double);
+
+  // the leading dimension for the given stride between extent entries of length len
+  auto dist = [&](py::ssize_t stride, py::ssize_t extent, py::ssize_t len) -> size_t {
+    if (extent <= 1) return std::max<py::ssize_t>(len, 1);
+    if (stride <= 0 || stride % d != 0 || stride/d < len)
+      throw std::invalid_argument(who + " needs positive strides of whole doubles, without overlap");
+    return stride/d;
+  };
+
+  if (info.ndim == 1)
+  {
+    size_t n = info.shape[0];
+    f(MatrixView<double, RowMajor>(n, 1, dist(info.strides[0], n, 1), data));
+  }
+  else if (info.ndim == 2)
+  {
+    py::ssize_t h = info.shape[0], w = info.shape[1];
+    if (w <= 1 || info.strides[1] == d)
+      f(MatrixView<double, RowMajor>(h, w, dist(info.strides[0], h, w), data));
+    else if (h <= 1 || info.strides[0] == d)
+      f(MatrixView<double, ColMajor>(h, w, dist(info.strides[1], w, h), data));
+    else
+      throw std::invalid_argument(who + " needs a matrix with contiguous rows or columns");
+  }
+  else
+    throw std::invalid_argument(who + " needs a vector or a matrix");
+}
+
 
 PYBIND11_MODULE(cla, m) {
     m.doc() = "Basic linear algebra module"; // optional module docstring
+
+    // the global task pool used by the parallel kernels
+    m.def("SetNumThreads", &SetNumThreads, py::arg("num_threads"),
+          "restart the task pool with num_threads threads (0: all hardware threads)");
+    m.def("NumThreads", &NumThreads, "number of threads of the task pool");
+    m.def("StartTaskPool", &StartTaskPool, py::arg("num_threads") = 0,
+          "start the task pool (otherwise, it is started on first use)");
+    m.def("StopTaskPool", &StopTaskPool, "stop the worker threads of the task pool");
+    m.def("LoadGemmProfile", &LoadGemmProfile, py::arg("path"),
+          "use the micro-kernel and block sizes of a profile written by tune_fastmult");
     
     py::class_<Vector<double>> (m, "Vector", py::buffer_protocol())
       .def(py::init<size_t>(),
@@ -173,18 +224,76 @@ PYBIND11_MODULE(cla, m) {
     ;
 
 
-/*
   // LapackLU class
-    py::class_<LapackLU<RowMajor>> (m, "LapackLU")
+  py::class_<LapackLU<RowMajor>> (m, "LapackLU")
     .def(py::init<Matrix<double,RowMajor>>(), "create new LapackLU object")
-    .def("Solve", [](LapackLU<RowMajor> & self, Vector<double> b){self.Solve(b);}, py::arg("b"))
-    .def("Inverse", [](LapackLU<RowMajor> & self){return (Matrix<double,RowMajor>) self.Inverse();}) 
-    .def("LFactor", [](LapackLU<RowMajor> & self){return (Matrix<double,RowMajor>) self.LFactor();})
-    .def("UFactor", [](LapackLU<RowMajor> & self){return (Matrix<double,RowMajor>) self.UFactor();})
-    .def("PFactor", [](LapackLU<RowMajor> & self){return (Matrix<double,RowMajor>) self.PFactor();})
-  ;
-}
-*/
+    // b is solved in place: any writable buffer of doubles (Vector, Matrix, numpy array), nothing is copied.
+    // A 2D buffer holds one right hand side per column, C- and Fortran-ordered arrays are both handled
+    // by one BLAS-3 call. The buffer is read like for the triangular and permutation views (WithMatrixView).
+    .def("Solve", [](LapackLU<RowMajor> & self, py::buffer b, bool transposed){
+      // Solve checks the height of B against the factored matrix
+      WithMatrixView(b, "LapackLU.Solve", [&](auto B) { self.Solve(B, transposed); });
+    }, py::arg("b"), py::arg("transposed") = false)
+    // on a copy of the factors, so LView, UView and PView stay valid
+    .def("Inverse", [](const LapackLU<RowMajor> & self){return Matrix<double,RowMajor> (self.Inverse());})
+    .def("LFactor", [](LapackLU<RowMajor> & self){return Matrix<double,RowMajor> (self.LFactor());})
+    .def("UFactor", [](LapackLU<RowMajor> & self){return Matrix<double,RowMajor> (self.UFactor());})
+    .def("PFactor", [](LapackLU<RowMajor> & self){return Matrix<double,RowMajor> (self.PFactor());})
+    // L, U and P referencing the factorization (A = P L U); each view keeps the LapackLU alive
+    .def("LView", [](LapackLU<RowMajor> & self){ return self.LView(); }, py::keep_alive<0, 1>(),
+         "unit lower triangular factor, without copying")
+    .def("UView", [](LapackLU<RowMajor> & self){ return self.UView(); }, py::keep_alive<0, 1>(),
+         "upper triangular factor, without copying")
+    .def("PView", [](LapackLU<RowMajor> & self){ return self.PView(); }, py::keep_alive<0, 1>(),
+         "permutation as the row exchanges of the factorization, without copying")
+    ;
+
+  // a triangle of a matrix owned by someone else, e.g. LapackLU.LView()
+  typedef TriangularView<double, ColMajor> TriangularViewCM;
+  py::class_<TriangularViewCM> (m, "TriangularView")
+    .def_property_readonly("shape", [](const TriangularViewCM & self) {
+      return py::make_tuple(self.height(), self.width());
+    })
+    .def_property_readonly("lower", [](const TriangularViewCM & self) { return self.Triangle() == Lower; })
+    .def_property_readonly("unit", [](const TriangularViewCM & self) { return self.Unit(); })
+    .def("__getitem__", [](const TriangularViewCM & self, std::tuple<size_t, size_t> ind) {
+      auto [i, j] = ind;
+      if (i >= self.height() || j >= self.width()) throw py::index_error("matrix index out of range");
+      return self(i, j);
+    })
+    // b overwritten with T^{-1} b (T^{-T} b), for vectors and for all columns of matrices
+    .def("Solve", [](const TriangularViewCM & self, py::buffer b, bool transposed) {
+      WithMatrixView(b, "TriangularView.Solve", [&](auto B) {
+        if (B.height() != self.height()) throw std::invalid_argument("TriangularView.Solve: wrong height");
+        if (transposed)
+          multtrsm(self.transposed(), B);
+        else
+          multtrsm(self, B);
+      });
+    }, py::arg("b"), py::arg("transposed") = false)
+    // b overwritten with T b (T^T b)
+    .def("Mult", [](const TriangularViewCM & self, py::buffer b, bool transposed) {
+      WithMatrixView(b, "TriangularView.Mult", [&](auto B) {
+        if (B.height() != self.height()) throw std::invalid_argument("TriangularView.Mult: wrong height");
+        if (transposed)
+          multtrmm(self.transposed(), B);
+        else
+          multtrmm(self, B);
+      });
+    }, py::arg("b"), py::arg("transposed") = false)
+    .def("Dense", [](const TriangularViewCM & self) { return Matrix<double, RowMajor>(self); },
+         "copy to a dense Matrix with explicit zeros")
+    ;
+
+  py::class_<PermutationView<integer>> (m, "Permutation")
+    .def("__len__", &PermutationView<integer>::Size)
+    // b overwritten with P b (P^T b), row exchanges of vectors and of all columns of matrices
+    .def("Apply", [](const PermutationView<integer> & self, py::buffer b, bool transposed) {
+      WithMatrixView(b, "Permutation.Apply", [&](auto B) { self.Apply(B, transposed); });
+    }, py::arg("b"), py::arg("transposed") = false)
+    .def("Indices", &PermutationView<integer>::Indices,
+         "row k of P^T A is row Indices()[k] of A")
+    ;
 
 /* // LapackLU class
 template <Neo_CLA::ORDERING ORD>
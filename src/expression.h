@@ -1,10 +1,145 @@
 #ifndef FILE_EXPRESSION_H
 #define FILE_EXPRESSION_H
 
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <vector>
+
+#include "forward_decl.h"
+#include "simd.h"
+#include "taskpool.h"
+
 
 namespace Neo_CLA
 {
 
+  // Expressions of double vectors whose leaves all have unit stride can be evaluated
+  // in SIMD packets: they set packet_ok and provide Packet<N>(i), the elements i...i+N-1.
+  template <typename T, typename = void>
+  struct has_packets : std::false_type {};
+
+  template <typename T>
+  struct has_packets<T, std::void_t<decltype(T::packet_ok)> >
+    : std::integral_constant<bool, T::packet_ok> {};
+
+  // Expressions whose entry i only depends on the entries i of their vectors set elementwise
+  // (unlike matrix-vector products), see Fused in vector.h.
+  template <typename T, typename = void>
+  struct has_elementwise : std::false_type {};
+
+  template <typename T>
+  struct has_elementwise<T, std::void_t<decltype(T::elementwise)> >
+    : std::integral_constant<bool, T::elementwise> {};
+
+  // number of doubles per packet in assignments
+  constexpr int packet_size = 4;
+
+
+  // Vector operations with at least VectorParallelThreshold() entries are split across the task pool.
+  // Sums (scalar products, norms) add up partial sums of chunks pairwise, in a fixed order.
+  // With ReproducibleReductions() set, the chunks only depend on the vector size (not on the number of threads
+  // nor on the threshold), so results are bitwise identical for any thread count.
+  inline size_t & VectorParallelThreshold()
+  {
+    static size_t threshold = size_t(1) << 17;
+    return threshold;
+  }
+
+  inline bool & ReproducibleReductions()
+  {
+    static bool reproducible = false;
+    return reproducible;
+  }
+
+  // entries per chunk of reproducible reductions
+  constexpr size_t reproducible_chunk = size_t(1) << 14;
+
+  inline bool ParallelVectorOp(size_t n)
+  {
+    return n >= VectorParallelThreshold() && NumThreads() > 1;
+  }
+
+  // calls func(first, next) for a partition of [0, n), on all threads of the pool if n is large;
+  // the boundaries are multiples of 8, so threads don't share cache lines of double vectors
+  template <typename FUNC>
+  void ParallelRanges(size_t n, FUNC func)
+  {
+    if (!ParallelVectorOp(n))
+    {
+      func(size_t(0), n);
+      return;
+    }
+
+    RunParallel(NumThreads(), [&](int nr, int size) {
+      size_t first = std::min(n, n*nr/size / 8 * 8);
+      size_t next = (nr+1 == size) ? n : std::min(n, n*(nr+1)/size / 8 * 8);
+      if (first < next) func(first, next);
+    });
+  }
+
+  // calls func(first, next) for a partition of [0, blocks), on all threads of the pool if the
+  // blocks hold at least VectorParallelThreshold() entries of block_size each
+  template <typename FUNC>
+  void ParallelBlocks(size_t blocks, size_t block_size, FUNC func)
+  {
+    if (!ParallelVectorOp(blocks*block_size))
+    {
+      func(size_t(0), blocks);
+      return;
+    }
+
+    RunParallel(NumThreads(), [&](int nr, int size) {
+      size_t first = blocks*nr/size;
+      size_t next = blocks*(nr+1)/size;
+      if (first < next) func(first, next);
+    });
+  }
+
+  // the sum of partial(first, next) over chunks of [0, n), added up as a binary tree
+  template <typename TSUM, typename FUNC>
+  TSUM ParallelSum(size_t n, FUNC partial)
+  {
+    bool parallel = ParallelVectorOp(n);
+    if (!parallel && !ReproducibleReductions())
+      return partial(size_t(0), n);
+
+    size_t chunk = ReproducibleReductions() ? reproducible_chunk : (n + NumThreads() - 1) / NumThreads();
+    size_t nchunks = (n + chunk - 1) / chunk;
+    if (nchunks == 0) return TSUM(0);
+
+    std::vector<TSUM> sums(nchunks);
+    auto compute = [&](size_t c) { sums[c] = partial(c*chunk, std::min(n, (c+1)*chunk)); };
+
+    if (parallel)
+      RunParallel(std::min(NumThreads(), nchunks), [&](int nr, int size) {
+        for (size_t c = nr; c < nchunks; c += size)
+          compute(c);
+      });
+    else
+      for (size_t c = 0; c < nchunks; c++)
+        compute(c);
+
+    for (size_t step = 1; step < nchunks; step *= 2)
+      for (size_t c = 0; c+step < nchunks; c += 2*step)
+        sums[c] += sums[c+step];
+    return sums[0];
+  }
+
+
+  // How expression nodes hold their operands: objects that own their data (owns_data = true) by reference,
+  // so they are never copied, everything else (views, other nodes) by value. Views are as cheap as a pointer,
+  // and nodes may be temporaries that would be gone before the expression is evaluated.
+  template <typename T, typename = void>
+  struct expr_storage { typedef T type; };
+
+  template <typename T>
+  struct expr_storage<T, std::enable_if_t<T::owns_data> > { typedef const T & type; };
+
+  template <typename T>
+  using expr_storage_t = typename expr_storage<T>::type;
+
+
   template <typename T>
   class VectorExpr
   {
@@ -13,26 +148,31 @@ namespace Neo_CLA
     VectorExpr() = default;
     VectorExpr(const VectorExpr & v) = default;
    public:
-    auto Upcast() const { return static_cast<const T&> (*this); }
-    size_t Size() const { return Upcast().Size(); }
-    auto operator() (size_t i) const { return Upcast()(i); }
+    constexpr const T & Upcast() const { return static_cast<const T&> (*this); }
+    constexpr size_t Size() const { return Upcast().Size(); }
+    constexpr auto operator() (size_t i) const { return Upcast()(i); }
   };
   
  
   template <typename TA, typename TB>
   class SumVecExpr : public VectorExpr<SumVecExpr<TA,TB>>
   {
-    TA a_;
-    TB b_;
+    expr_storage_t<TA> a_;
+    expr_storage_t<TB> b_;
   public:
-    SumVecExpr (TA a, TB b) : a_(a), b_(b) { }
+    constexpr SumVecExpr (const TA & a, const TB & b) : a_(a), b_(b) { }
 
-    auto operator() (size_t i) const { return a_(i)+b_(i); }
-    size_t Size() const { return a_.Size(); }      
+    static constexpr bool packet_ok = has_packets<TA>::value && has_packets<TB>::value;
+    static constexpr bool elementwise = has_elementwise<TA>::value && has_elementwise<TB>::value;
+
+    constexpr auto operator() (size_t i) const { return a_(i)+b_(i); }
+    template <int N>
+    auto Packet (size_t i) const { return a_.template Packet<N>(i) + b_.template Packet<N>(i); }
+    constexpr size_t Size() const { return a_.Size(); }      
   };
   
   template <typename TA, typename TB>
-  auto operator+ (const VectorExpr<TA> & a, const VectorExpr<TB> & b)
+  constexpr auto operator+ (const VectorExpr<TA> & a, const VectorExpr<TB> & b)
   {
     return SumVecExpr(a.Upcast(), b.Upcast());
   }
@@ -41,17 +181,22 @@ namespace Neo_CLA
   template <typename TA, typename TB>
   class DifferenceVecExpr : public VectorExpr<DifferenceVecExpr<TA,TB>>
   {
-    TA a_;
-    TB b_;
+    expr_storage_t<TA> a_;
+    expr_storage_t<TB> b_;
   public:
-    DifferenceVecExpr (TA a, TB b) : a_(a), b_(b) { }
+    constexpr DifferenceVecExpr (const TA & a, const TB & b) : a_(a), b_(b) { }
+
+    static constexpr bool packet_ok = has_packets<TA>::value && has_packets<TB>::value;
+    static constexpr bool elementwise = has_elementwise<TA>::value && has_elementwise<TB>::value;
 
-    auto operator() (size_t i) const { return a_(i)-b_(i); }
-    size_t Size() const { return a_.Size(); }      
+    constexpr auto operator() (size_t i) const { return a_(i)-b_(i); }
+    template <int N>
+    auto Packet (size_t i) const { return a_.template Packet<N>(i) - b_.template Packet<N>(i); }
+    constexpr size_t Size() const { return a_.Size(); }      
   };
   
   template <typename TA, typename TB>
-  auto operator- (const VectorExpr<TA> & a, const VectorExpr<TB> & b)
+  constexpr auto operator- (const VectorExpr<TA> & a, const VectorExpr<TB> & b)
   {
     return DifferenceVecExpr(a.Upcast(), b.Upcast());
   }
@@ -63,16 +208,21 @@ namespace Neo_CLA
   class ScaleVecExpr : public VectorExpr<ScaleVecExpr<TSCAL,TV>>
   {
     TSCAL scal_;
-    TV vec_;
+    expr_storage_t<TV> vec_;
   public:
-    ScaleVecExpr (TSCAL scal, TV vec) : scal_(scal), vec_(vec) { }
+    constexpr ScaleVecExpr (TSCAL scal, const TV & vec) : scal_(scal), vec_(vec) { }
 
-    auto operator() (size_t i) const { return scal_*vec_(i); }
-    size_t Size() const { return vec_.Size(); }      
+    static constexpr bool packet_ok = std::is_same<TSCAL, double>::value && has_packets<TV>::value;
+    static constexpr bool elementwise = has_elementwise<TV>::value;
+
+    constexpr auto operator() (size_t i) const { return scal_*vec_(i); }
+    template <int N>
+    auto Packet (size_t i) const { return Neo_HPC::SIMD<double, N>(scal_) * vec_.template Packet<N>(i); }
+    constexpr size_t Size() const { return vec_.Size(); }      
   };
   
   template <typename T>
-  auto operator* (double scal, const VectorExpr<T> & v)
+  constexpr auto operator* (double scal, const VectorExpr<T> & v)
   {
     return ScaleVecExpr(scal, v.Upcast());
   }
@@ -90,6 +240,271 @@ namespace Neo_CLA
   }
 
 
+  // SCALAR PRODUCTS -------------------------------------------------------------
+  // Kernels for sum a(i)*b(i) over [first, next) of double vectors and expressions.
+  // If both sides provide SIMD packets, they are read in packets, else element by element.
+
+  // how scalar products of double vectors are summed up
+  enum SUMMATION {
+    FastSum,     // several independent accumulators: fastest, error grows with n
+    KahanSum,    // compensated (TwoSum, and TwoProduct for the product errors): as accurate as in twice the precision
+    PairwiseSum  // recursive halving: error grows with log(n), almost as fast as FastSum
+  };
+
+  inline SUMMATION & Summation()
+  {
+    static SUMMATION mode = FastSum;
+    return mode;
+  }
+
+  // four independent accumulators, so four FMAs are in flight instead of one dependent chain
+  template <typename TA, typename TB>
+  double DotFast (const TA & a, const TB & b, size_t first, size_t next)
+  {
+    size_t i = first;
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+    if constexpr (has_packets<TA>::value && has_packets<TB>::value)
+    {
+      constexpr int N = packet_size;
+      typedef Neo_HPC::SIMD<double, N> SIMDT;
+      SIMDT p0(0.0), p1(0.0), p2(0.0), p3(0.0);
+      for ( ; i + 4*N <= next; i += 4*N)
+      {
+        p0 = FMA(a.template Packet<N>(i), b.template Packet<N>(i), p0);
+        p1 = FMA(a.template Packet<N>(i+N), b.template Packet<N>(i+N), p1);
+        p2 = FMA(a.template Packet<N>(i+2*N), b.template Packet<N>(i+2*N), p2);
+        p3 = FMA(a.template Packet<N>(i+3*N), b.template Packet<N>(i+3*N), p3);
+      }
+      for ( ; i + N <= next; i += N)
+        p0 = FMA(a.template Packet<N>(i), b.template Packet<N>(i), p0);
+      s0 = HSum((p0 + p1) + (p2 + p3));
+    }
+
+    for ( ; i + 4 <= next; i += 4)
+    {
+      s0 += a(i)*b(i);
+      s1 += a(i+1)*b(i+1);
+      s2 += a(i+2)*b(i+2);
+      s3 += a(i+3)*b(i+3);
+    }
+    for ( ; i < next; i++)
+      s0 += a(i)*b(i);
+    return (s0 + s1) + (s2 + s3);
+  }
+
+  // The error-free transformations below need every product rounded on its own. GCC contracts a*b + c into
+  // an FMA even across statements (-ffp-contract=fast), which would fold the product error into TwoSum and
+  // count it twice, so contraction is switched off for them. Clang and MSVC only contract within expressions.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC push_options
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+  // sum + err = a + b exactly
+  template <typename T>
+  inline void TwoSum (T a, T b, T & sum, T & err)
+  {
+    sum = a + b;
+    T bb = sum - a;
+    err = (a - (sum - bb)) + (b - bb);
+  }
+
+  // prod + err = a * b exactly (for double and SIMD packets of doubles): with a fused multiply-add if the
+  // hardware has one, else by Dekker's product of the halves from Veltkamp's splitting
+  template <typename T>
+  inline void TwoProduct (T a, T b, T & prod, T & err)
+  {
+    prod = a * b;
+#ifdef FP_FAST_FMA
+    if constexpr (std::is_same<T, double>::value)
+      err = std::fma(a, b, -prod);
+    else
+      err = FMA(a, b, T(0.0) - prod);
+#else
+    auto split = [](T x, T & hi, T & lo) {
+      T c = T(134217729.0) * x; // 2^27 + 1
+      hi = c - (c - x);
+      lo = x - hi;
+    };
+    T ahi, alo, bhi, blo;
+    split(a, ahi, alo);
+    split(b, bhi, blo);
+    err = ((ahi*bhi - prod) + ahi*blo + alo*bhi) + alo*blo;
+#endif
+  }
+
+  // Ogita-Rump-Oishi Dot2: the rounding errors of all products and additions are summed up separately
+  template <typename TA, typename TB>
+  double DotKahan (const TA & a, const TB & b, size_t first, size_t next)
+  {
+    size_t i = first;
+    double sum = 0, comp = 0, err;
+
+    if constexpr (has_packets<TA>::value && has_packets<TB>::value)
+    {
+      constexpr int N = packet_size;
+      typedef Neo_HPC::SIMD<double, N> SIMDT;
+      SIMDT psum(0.0), pcomp(0.0), perr;
+      for ( ; i + N <= next; i += N)
+      {
+        SIMDT x = a.template Packet<N>(i);
+        SIMDT y = b.template Packet<N>(i);
+        SIMDT prod, proderr;
+        TwoProduct(x, y, prod, proderr);
+        TwoSum(psum, prod, psum, perr);
+        pcomp = pcomp + (perr + proderr);
+      }
+      for (int l = 0; l < N; l++)
+      {
+        TwoSum(sum, psum[l], sum, err);
+        comp += err + pcomp[l];
+      }
+    }
+
+    for ( ; i < next; i++)
+    {
+      double prod, proderr;
+      TwoProduct(double(a(i)), double(b(i)), prod, proderr);
+      TwoSum(sum, prod, sum, err);
+      comp += err + proderr;
+    }
+    return sum + comp;
+  }
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC pop_options
+#endif
+
+  template <typename TA, typename TB>
+  double DotPairwise (const TA & a, const TB & b, size_t first, size_t next)
+  {
+    if (next - first <= 256)
+      return DotFast(a, b, first, next);
+
+    size_t mid = first + (next - first) / 2 / packet_size * packet_size;
+    return DotPairwise(a, b, first, mid) + DotPairwise(a, b, mid, next);
+  }
+
+  template <typename TA, typename TB>
+  double DotRange (const TA & a, const TB & b, size_t first, size_t next)
+  {
+    switch (Summation())
+    {
+      case KahanSum: return DotKahan(a, b, first, next);
+      case PairwiseSum: return DotPairwise(a, b, first, next);
+      default: return DotFast(a, b, first, next);
+    }
+  }
+
+  // scalar product of two vector expressions a and b of the same size
+  template <typename TA, typename TB>
+  auto Dot (const TA & a, const TB & b)
+  {
+    typedef decltype(a(0)*b(0)) TSUM;
+
+    if constexpr (std::is_same<TSUM, double>::value)
+    {
+      return ParallelSum<TSUM>(a.Size(), [&](size_t first, size_t next) {
+        return DotRange(a, b, first, next);
+      });
+    }
+    else
+    {
+      return ParallelSum<TSUM>(a.Size(), [&](size_t first, size_t next) {
+        TSUM product = 0;
+        for (size_t i = first; i < next; i++){
+          product += a(i)*b(i);
+        }
+        return product;
+      });
+    }
+  }
+
+  // 2-norm without overflow and underflow (like LAPACK's dnrm2): the plain sum of squares is used
+  // when it is safely in range, else the squares are summed up relative to the largest entry
+  template <typename TV>
+  auto Norm (const TV & v)
+  {
+    auto ss = Dot(v, v);
+    if constexpr (!std::is_same<decltype(ss), double>::value)
+    {
+      return std::sqrt(ss);
+    }
+    else
+    {
+      // n squares below the smallest normal number are negligible compared to this
+      if ((std::isfinite(ss) && ss > 0x1p-900) || std::isnan(ss))
+        return std::sqrt(ss);
+
+      double scale = 0, ssq = 1;
+      for (size_t i = 0; i < v.Size(); i++)
+      {
+        double x = std::abs(v(i));
+        if (x == 0) continue;
+        if (scale < x)
+        {
+          ssq = 1 + ssq * (scale/x) * (scale/x);
+          scale = x;
+        }
+        else
+          ssq += (x/scale) * (x/scale);
+      }
+      return scale * std::sqrt(ssq);
+    }
+  }
+
+
+  // BLAS ROUTES -----------------------------------------------------------------
+  // x*y of double vectors and assignments of A*x use the BLAS for operands with at least the threshold
+  // number of entries, and the native kernels below (no call overhead, and the summation modes are kept).
+  // lapack_interface.h fills in the routes; without them, everything is computed natively.
+  struct BlasDispatch
+  {
+    // crossovers against OpenBLAS on an AVX-512 Xeon, tune_fastmult measures them for the machine at hand
+    // (see GemmProfile). Built for SSE2 only, ddot and dgemv are faster from the smallest sizes on; with AVX2
+    // Dot and the column-major multgemv are faster in the caches, and BLAS only catches up on vectors and
+    // matrices limited by the memory bandwidth.
+#ifdef __AVX2__
+    size_t dot_threshold = size_t(1) << 20;  // vector length
+    size_t gemv_threshold = size_t(1) << 20; // height*width of the matrix
+#else
+    size_t dot_threshold = 16;
+    size_t gemv_threshold = 64;
+#endif
+
+    // x^T y
+    double (*dot) (size_t n, double * x, size_t incx, double * y, size_t incy) = nullptr;
+    // y = alpha A x + beta y for the h x w column-major matrix a (A^T x if transposed is set)
+    void (*gemv) (bool transposed, size_t h, size_t w, double alpha, double * a, size_t lda,
+                  double * x, size_t incx, double beta, double * y, size_t incy) = nullptr;
+  };
+
+  inline BlasDispatch & BlasRoutes()
+  {
+    static BlasDispatch routes;
+    return routes;
+  }
+
+  // BLAS sums up in its own order, so it is only used for the default summation
+  inline bool UseBlasDot(size_t n)
+  {
+    return BlasRoutes().dot && n >= BlasRoutes().dot_threshold
+      && Summation() == FastSum && !ReproducibleReductions();
+  }
+
+  // true for ProdMatVecExpr (see matrix_expression.h), whose assignments go to AssignMatVec
+  template <typename T>
+  struct is_prod_matvec_expr : std::false_type {};
+
+  // true for VectorView<double, ...>
+  template <typename T>
+  struct is_double_vector_view : std::false_type {};
+
+  template <typename TDIST>
+  struct is_double_vector_view<VectorView<double, TDIST> > : std::true_type {};
+
+
   // scalar product
   template <typename T1, typename T2>
   auto operator* (const VectorExpr<T1> & v1, const VectorExpr<T2> & v2){
@@ -98,19 +513,13 @@ namespace Neo_CLA
       throw std::invalid_argument("vectors need to have same length for scalar product");
     }
 
-    decltype(v1(0)*v2(0)) product = 0;
-
-    for (size_t i = 0; i < v1.Size(); i++){
-      product += v1(i)*v2(i);
-    }
-
-    return product;
+    return Dot(static_cast<const T1&> (v1), static_cast<const T2&> (v2));
   }
 
   // 2-norm for vectors
   template <typename T>
   auto L2Norm (const VectorExpr<T> & v){
-    return std::sqrt(v*v);
+    return Norm(static_cast<const T&> (v));
   }
   
 }
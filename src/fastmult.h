@@ -2,13 +2,20 @@
 #define FILE_FASTMULT_H
 
 #include <algorithm>
+#include <atomic>
 #include <iostream>
-#include <mutex>
+#include <new>
+#include <optional>
 
+#include "arena.h"
+#include "gemmprofile.h"
 #include "matrix.h"
+#include "microkernels.h"
 #include "simd.h"
+#ifdef __AVX__
 #include "simd_avx.h"
-#include "taskmanager.cc"
+#endif
+#include "taskpool.h"
 #include "timer.cc"
 
 
@@ -45,40 +52,85 @@ void multkernel(MatrixView<double, RowMajor> C, MatrixView<double, ORD> A, Matri
 }
 
 
+// EDGES -----------------------------------------------------------------------
+// Blocks at the right and bottom border of C that are smaller than 4x12 are computed with masked
+// loads and stores. The masks only depend on the width of the block, so they are computed once
+// per block column, not in every step of the kernel.
+
+// masks for the three SIMD<double,4> of a block row of given width (at most 12)
+struct EdgeMasks
+{
+  SIMD<mask64, 4> mask0, mask1, mask2;
+
+  EdgeMasks(size_t width)
+    : mask0(width > IndexSequence<int64_t, 4, 0>()),
+      mask1(width > IndexSequence<int64_t, 4, 4>()),
+      mask2(width > IndexSequence<int64_t, 4, 8>()) {;}
+};
+
 // matrix product on a matrix block that is (potentially) smaller than 4x12, used to clean up leftover
-// almost the same as multkernel above, with added masks
+// almost the same as multkernel above, but with masks for the columns
 template <ORDERING ORD>
-void smallblock(MatrixView<double, RowMajor> C, MatrixView<double, ORD> A, MatrixView<double, RowMajor> B)
+void edgekernel(MatrixView<double, RowMajor> C, MatrixView<double, ORD> A, MatrixView<double, RowMajor> B,
+                const EdgeMasks & masks)
 {
-  // almost the same as in multkernel, but with masks
   for (size_t i=0; i < B.height(); i++)
   {
-    SIMD<int64_t, 4> sequ0 = IndexSequence<int64_t, 4, 0>();
-    SIMD<int64_t, 4> sequ1 = IndexSequence<int64_t, 4, 4>();
-    SIMD<int64_t, 4> sequ2 = IndexSequence<int64_t, 4, 8>();
-
-    SIMD<mask64, 4> mask0 = (B.width() > sequ0);
-    SIMD<mask64, 4> mask1 = (B.width() > sequ1);
-    SIMD<mask64, 4> mask2 = (B.width() > sequ2);
-
     // loads using masks
-    SIMD<double, 4> b0(&B(i, 0), mask0);
-    SIMD<double, 4> b1(&B(i, 4), mask1);
-    SIMD<double, 4> b2(&B(i, 8), mask2);
+    SIMD<double, 4> b0(&B(i, 0), masks.mask0);
+    SIMD<double, 4> b1(&B(i, 4), masks.mask1);
+    SIMD<double, 4> b2(&B(i, 8), masks.mask2);
 
     for (size_t k=0; k < A.height(); k++)
     {
       // now, we have picked out an element of A and a line of B
       // loading and storing is done with masking off the components of C that do not actually exist
-      FMA(SIMD<double, 4>(A(k, i)), b0, SIMD<double, 4>(&C(k, 0), mask0)).Store(&C(k, 0), mask0);
-      FMA(SIMD<double, 4>(A(k, i)), b1, SIMD<double, 4>(&C(k, 4), mask1)).Store(&C(k, 4), mask1);
-      FMA(SIMD<double, 4>(A(k, i)), b2, SIMD<double, 4>(&C(k, 8), mask2)).Store(&C(k, 8), mask2);
+      SIMD<double, 4> a(A(k, i));
+      FMA(a, b0, SIMD<double, 4>(&C(k, 0), masks.mask0)).Store(&C(k, 0), masks.mask0);
+      FMA(a, b1, SIMD<double, 4>(&C(k, 4), masks.mask1)).Store(&C(k, 4), masks.mask1);
+      FMA(a, b2, SIMD<double, 4>(&C(k, 8), masks.mask2)).Store(&C(k, 8), masks.mask2);
     }
   }
 }
 
+// the same for a single block, computes its masks itself
+template <ORDERING ORD>
+void smallblock(MatrixView<double, RowMajor> C, MatrixView<double, ORD> A, MatrixView<double, RowMajor> B)
+{
+  if (C.height() == 0 || C.width() == 0) return;
+  edgekernel(C, A, B, EdgeMasks(B.width()));
+}
 
-// This function computes a matrix product by passing individual blocks to multkernel/smallblock.
+// computes all parts of C that are not covered by full 4x12 blocks:
+// the rightmost columns, the bottom rows and the lower-right corner
+template <ORDERING ORD>
+void multedges(MatrixView<double, RowMajor> C, MatrixView<double, ORD> A, MatrixView<double, RowMajor> B)
+{
+  size_t m = C.height();
+  size_t n = C.width();
+  size_t mfull = m - m%4;
+  size_t nfull = n - n%12;
+
+  if (n % 12 != 0) // rightmost columns
+  {
+    EdgeMasks masks(n % 12);
+    for (size_t i=0; i < mfull; i += 4)
+      edgekernel(C.Rows(i, 4).Cols(nfull, n%12), A.Rows(i, 4), B.Cols(nfull, n%12), masks);
+  }
+
+  if (m % 4 != 0) // bottom rows
+  {
+    EdgeMasks masks(12);
+    for (size_t j=0; j < nfull; j += 12)
+      edgekernel(C.Rows(mfull, m%4).Cols(j, 12), A.Rows(mfull, m%4), B.Cols(j, 12), masks);
+
+    if (n % 12 != 0) // lower-right corner
+      edgekernel(C.Rows(mfull, m%4).Cols(nfull, n%12), A.Rows(mfull, m%4), B.Cols(nfull, n%12), EdgeMasks(n % 12));
+  }
+}
+
+
+// This function computes a matrix product by passing individual blocks to multkernel/edgekernel.
 template <ORDERING ORD>
 void multmatmat(MatrixView<double, RowMajor> C, MatrixView<double, ORD> A, MatrixView<double, RowMajor> B)
 {
@@ -86,7 +138,6 @@ void multmatmat(MatrixView<double, RowMajor> C, MatrixView<double, ORD> A, Matri
   // dimensions: C: mxn ; A: mxk ; B: kxn
   size_t m = C.height();
   size_t n = C.width();
-  size_t k = A.width();
   
   // how many full 4x12 blocks can we cram into C?
   size_t fullblocks_height = (m - (m % 4)) / 4;
@@ -101,36 +152,19 @@ void multmatmat(MatrixView<double, RowMajor> C, MatrixView<double, ORD> A, Matri
     }
   }
 
-  // cleanup:
-
-  // rightmost columns
-  for (size_t i=0; i < fullblocks_height; i++)
-  {
-    smallblock(C.Rows(i*4, 4).Cols(fullblocks_width*12, n%12), A.Rows(i*4, 4), B.Cols(fullblocks_width*12, n%12));
-  }
-
-  // rows all the way at the bottom
-  for (size_t j=0; j < fullblocks_width; j++)
-  {
-    smallblock(C.Rows(fullblocks_height*4, m%4).Cols(j*12, 12), A.Rows(fullblocks_height*4, m%4), B.Cols(j*12, 12));
-  }
-
-  // bottom-right corner
-  if ((m % 4) != 0 && (n % 4) != 0)
-  {
-    smallblock(C.Rows(fullblocks_height*4, m%4).Cols(fullblocks_width*12, 12), A.Rows(fullblocks_height*4, m%4), B.Cols(fullblocks_width*12, n%12));
-  }
+  // cleanup
+  multedges(C, A, B);
 }
 
 // CACHING ---------------------------------------------------------------------
 
 // computes the product for a block that can be filled with 4x12 matrices
 // helper function for multcachy
-template <ORDERING ORD, typename H = std::integral_constant<size_t, 4>, typename W = std::integral_constant<size_t, 12> >
+template <ORDERING ORD>
 void blockmultcachy(MatrixView<double, RowMajor> C, MatrixView<double, ORD> A, MatrixView<double, RowMajor> B)
 {
-  W w;
-  H h;
+  size_t w = 12;
+  size_t h = 4;
 
   for (size_t j=0; j+w <= C.width(); j += w)
   {
@@ -140,16 +174,8 @@ void blockmultcachy(MatrixView<double, RowMajor> C, MatrixView<double, ORD> A, M
     }
   }
 
-  // cleanup:
-
-  for (size_t i=0; i+h <= C.height(); i += h) // rightmost columns
-    smallblock(C.Rows(i, h).Cols(C.width() - C.width()%w, C.width()%w), A.Rows(i, h), B.Cols(C.width() - C.width()%w, C.width()%w));
-
-  for (size_t j=0; j+w <= C.width(); j += w) // bottom rows
-    smallblock(C.Rows(C.height() - C.height()%h, C.height()%h).Cols(j, w), A.Rows(C.height() - C.height()%h, C.height()%h), B.Cols(j, w));
-  
-  if ((C.height() % h) != 0 && (C.width() % w) != 0) // lower-right corner
-    smallblock(C.Rows(C.height() - C.height()%h, C.height()%h).Cols(C.width() - C.width()%w, C.width()%w), A.Rows(C.height() - C.height()%h, C.height()%h), B.Cols(C.width() - C.width()%w, C.width()%w));
+  // cleanup
+  multedges(C, A, B);
 }
 
 // same as multmatmat, but with caching
@@ -161,7 +187,8 @@ void multcachy(MatrixView<double, RowMajor> C, MatrixView<double, ORD> A, Matrix
   BH bh;
   BW bw;
 
-  alignas (64) double memA[bh*bw]; // memory for Ablock
+  ArenaLease mem(bh*bw); // memory for Ablock, on the heap to allow large blocks
+  double * memA = mem.Data();
 
   for (size_t i1 = 0; i1 < A.height(); i1 += bh) {
     for (size_t j1 = 0; j1 < A.width(); j1 += bw) {
@@ -180,83 +207,272 @@ void multcachy(MatrixView<double, RowMajor> C, MatrixView<double, ORD> A, Matrix
 }
 
 
-// PARALLELIZATION -------------------------------------------------------------
+// PACKING ---------------------------------------------------------------------
+// GotoBLAS-style three-level blocking: both A and B are copied into contiguous panels,
+// so that the micro-kernels (see microkernels.h) read memory strictly sequentially.
 
-// the most powerful function
-// the same as multcachy, but with threads instead of loops
-template <typename BH = std::integral_constant<size_t, 96>, typename BW = std::integral_constant<size_t, 96>, ORDERING ORD>
-void multparallel(MatrixView<double, RowMajor> C, MatrixView<double, ORD> A, MatrixView<double, RowMajor> B)
+// smallest multiple of step that is >= n
+inline size_t roundup(size_t n, size_t step) { return (n + step - 1) / step * step; }
+
+// copies alpha*A into panels of mr rows, every panel stores the columns of A one after another
+// (mr doubles per column), rows missing in the last panel are filled with zeros.
+// The loops run along the storage of A, so both orderings are read contiguously.
+template <ORDERING ORD>
+void packA(MatrixView<double, ORD> A, double * Ap, size_t mr, double alpha = 1.0)
 {
-  BH bh;
-  BW bw;
+  size_t k = A.width();
+  for (size_t i0 = 0; i0 < A.height(); i0 += mr, Ap += mr*k)
+  {
+    size_t h = std::min(mr, A.height()-i0);
+    if constexpr (ORD == RowMajor)
+    {
+      for (size_t r = 0; r < h; r++)
+        for (size_t p = 0; p < k; p++)
+          Ap[p*mr + r] = alpha * A(i0+r, p);
+    }
+    else
+    {
+      for (size_t p = 0; p < k; p++)
+        for (size_t r = 0; r < h; r++)
+          Ap[p*mr + r] = alpha * A(i0+r, p);
+    }
+    for (size_t r = h; r < mr; r++)
+      for (size_t p = 0; p < k; p++)
+        Ap[p*mr + r] = 0.0;
+  }
+}
 
-  // as many workers as threads supported by your machine, minus one
-  StartWorkers(std::thread::hardware_concurrency() - 1);
+// copies B into panels of nr columns, every panel stores the rows of B one after another
+// (nr doubles per row), columns missing in the last panel are filled with zeros
+template <ORDERING ORD>
+void packB(MatrixView<double, ORD> B, double * Bp, size_t nr)
+{
+  size_t k = B.height();
+  for (size_t j0 = 0; j0 < B.width(); j0 += nr, Bp += nr*k)
+  {
+    size_t w = std::min(nr, B.width()-j0);
+    if constexpr (ORD == RowMajor)
+    {
+      for (size_t p = 0; p < k; p++)
+        for (size_t c = 0; c < w; c++)
+          Bp[p*nr + c] = B(p, j0+c);
+    }
+    else
+    {
+      for (size_t c = 0; c < w; c++)
+        for (size_t p = 0; p < k; p++)
+          Bp[p*nr + c] = B(p, j0+c);
+    }
+    for (size_t p = 0; p < k; p++)
+      for (size_t c = w; c < nr; c++)
+        Bp[p*nr + c] = 0.0;
+  }
+}
 
-  RunParallel((A.height()/bh) + 1, [&](int i0, int s){    
-    std::mutex linemutex; // prevents race condition in kernel and memA
-    alignas (64) double memA[bh*bw]; // if larger lines are locked, not that much allocation is necessary
+// C += A*B, where A (C.height() x kc) and B (kc x C.width()) have been packed for the kernel
+inline void multpanels(MatrixView<double, RowMajor> C, const double * Ap, const double * Bp, size_t kc,
+                       const MicroKernel & kernel)
+{
+  for (size_t jr = 0; jr < C.width(); jr += kernel.nr)
+    for (size_t ir = 0; ir < C.height(); ir += kernel.mr)
+      kernel.func(kc, Ap + ir*kc, Bp + jr*kc, &C(ir, jr), C.Dist(),
+                  std::min(kernel.mr, C.height()-ir), std::min(kernel.nr, C.width()-jr));
+}
 
-    RunParallel((A.width()/bw) + 1, [&](int j0, int s2){
-      
-      // indices for the block matrices
-      size_t i1 = i0*bh;
-      size_t j1 = j0*bw;
-      size_t i2 = std::min(A.height(), i1+bh);
-      size_t j2 = std::min(A.width(), j1+bw);
+// C += alpha*A*B with packed blocks of A and B, A and B may have any ordering
+template <ORDERING ORDA, ORDERING ORDB>
+void multpacked(MatrixView<double, RowMajor> C, MatrixView<double, ORDA> A, MatrixView<double, ORDB> B,
+                double alpha = 1.0, GemmBlocking blocks = GemmDefaults())
+{
+  const MicroKernel & kernel = ActiveMicroKernel();
 
-      MatrixView Ablock(i2-i1, j2-j1, bw, memA);
+  size_t mc = roundup(std::max(size_t(1), blocks.mc), kernel.mr);
+  size_t kc = std::max(size_t(1), blocks.kc);
+  size_t nc = roundup(std::max(size_t(1), blocks.nc), kernel.nr);
 
-      std::lock_guard<std::mutex> lock(linemutex); // lock
+  size_t m = C.height();
+  size_t n = C.width();
+  size_t k = A.width();
 
-      Ablock = A.Rows(i1,i2-i1).Cols(j1,j2-j1);
-      
-      blockmultcachy (C.Rows(i1, i2-i1), Ablock, B.Rows(j1, j2-j1));
-    });
-  });
+  size_t sizeA = roundup(mc*kc, 8); // keep the 64-byte alignment of memB
+  ArenaLease mem(sizeA + kc*nc);
+  double * memA = mem.Data();
+  double * memB = memA + sizeA;
+
+  for (size_t jc = 0; jc < n; jc += nc)
+  {
+    size_t nb = std::min(nc, n-jc);
+
+    for (size_t pc = 0; pc < k; pc += kc)
+    {
+      size_t kb = std::min(kc, k-pc);
+      packB(B.Rows(pc, kb).Cols(jc, nb), memB, kernel.nr); // L3
+
+      for (size_t ic = 0; ic < m; ic += mc)
+      {
+        size_t mb = std::min(mc, m-ic);
+        packA(A.Rows(ic, mb).Cols(pc, kb), memA, kernel.mr, alpha); // L2
 
-  StopWorkers();
+        multpanels(C.Rows(ic, mb).Cols(jc, nb), memA, memB, kb, kernel);
+      }
+    }
+  }
 }
 
-// a variant of multparallel that creates performance statistics
-template <typename BH = std::integral_constant<size_t, 96>, typename BW = std::integral_constant<size_t, 96>, ORDERING ORD>
-void multparallel_timed(MatrixView<double, RowMajor> C, MatrixView<double, ORD> A, MatrixView<double, RowMajor> B)
+
+// PARALLELIZATION -------------------------------------------------------------
+
+// the most powerful function
+// the same as multpacked, but with threads instead of loops:
+// C += alpha*A*B, where C is split into independent tiles of BH rows and TW columns, which are handed out
+// to the threads of the task pool through an atomic counter. Every thread packs
+// A and B into its own buffers, so there is no lock on the hot path, and every
+// tile is computed by one thread in a fixed order (results do not depend on the thread count).
+// If timer is given, every tile is recorded as a region of it.
+template <typename BH = std::integral_constant<size_t, 0>, typename BW = std::integral_constant<size_t, 0>,
+          typename TW = std::integral_constant<size_t, 0>, ORDERING ORD, ORDERING ORDB = RowMajor>
+void multparallel(MatrixView<double, RowMajor> C, MatrixView<double, ORD> A, MatrixView<double, ORDB> B,
+                  double alpha = 1.0, Timer * timer = nullptr)
 {
-  BH bh;
-  BW bw;
+  // 0 takes the tuned value (see gemmprofile.h)
+  GemmBlocking defaults = GemmDefaults();
+  size_t bh = BH::value ? BH::value : std::max(size_t(1), defaults.mc);
+  size_t bw = BW::value ? BW::value : std::max(size_t(1), defaults.kc);
+  size_t tw = TW::value ? TW::value : std::max(size_t(1), defaults.tw);
+
+  size_t rowtiles = (C.height() + bh - 1) / bh;
+  size_t coltiles = (C.width() + tw - 1) / tw;
+  size_t ntiles = rowtiles * coltiles;
+  std::atomic<size_t> nexttile{0};
+  if (ntiles == 0) return;
+
+  const MicroKernel & kernel = ActiveMicroKernel();
+
+  // one task per thread, the tiles are distributed dynamically
+  RunParallel(std::min(NumThreads(), ntiles), [&](int, int){
+    // private to this thread
+    size_t sizeA = roundup(roundup(bh, kernel.mr)*bw, 8); // keep the 64-byte alignment of memB
+    ArenaLease mem(sizeA + bw*roundup(tw, kernel.nr));
+    double * memA = mem.Data();
+    double * memB = memA + sizeA;
+
+    for (size_t tile = nexttile++; tile < ntiles; tile = nexttile++)
+    {
+      std::optional<RegionTimer> reg;
+      if (timer) reg.emplace(*timer);
+
+      // consecutive tiles share the rows of A
+      size_t i1 = (tile / coltiles) * bh;
+      size_t j1 = (tile % coltiles) * tw;
+      size_t i2 = std::min(C.height(), i1+bh);
+      size_t j2 = std::min(C.width(), j1+tw);
+
+      for (size_t k1 = 0; k1 < A.width(); k1 += bw)
+      {
+        size_t k2 = std::min(A.width(), k1+bw);
 
+        packA(A.Rows(i1, i2-i1).Cols(k1, k2-k1), memA, kernel.mr, alpha);
+        packB(B.Rows(k1, k2-k1).Cols(j1, j2-j1), memB, kernel.nr);
+
+        multpanels(C.Rows(i1, i2-i1).Cols(j1, j2-j1), memA, memB, k2-k1, kernel);
+      }
+    }
+  });
+}
+
+// a variant of multparallel that creates performance statistics
+template <typename BH = std::integral_constant<size_t, 0>, typename BW = std::integral_constant<size_t, 0>,
+          typename TW = std::integral_constant<size_t, 0>, ORDERING ORD, ORDERING ORDB = RowMajor>
+void multparallel_timed(MatrixView<double, RowMajor> C, MatrixView<double, ORD> A, MatrixView<double, ORDB> B)
+{
   timeline = std::make_unique<TimeLine>("fastmult.trace");
   static Timer t("fastmult", {1, 0, 0});
 
-  // as many workers as threads supported by your machine, minus one
-  StartWorkers(std::thread::hardware_concurrency() - 1);
+  multparallel<BH, BW, TW>(C, A, B, 1.0, &t);
+}
 
-  RunParallel((A.height()/bh) + 1, [&](int i0, int s){    
-    std::mutex linemutex; // prevents race condition in kernel and memA
-    alignas (64) double memA[bh*bw]; // if larger lines are locked, not that much allocation is necessary
 
-    RunParallel((A.width()/bw) + 1, [&](int j0, int s2){
-      RegionTimer reg(t);
-      
-      // indices for the block matrices
-      size_t i1 = i0*bh;
-      size_t j1 = j0*bw;
-      size_t i2 = std::min(A.height(), i1+bh);
-      size_t j2 = std::min(A.width(), j1+bw);
+// EXPRESSIONS -----------------------------------------------------------------
 
-      MatrixView Ablock(i2-i1, j2-j1, bw, memA);
+// address behind the last element of a view
+template <ORDERING ORD>
+const double * dataend(MatrixView<double, ORD> M)
+{
+  if constexpr (ORD == RowMajor)
+    return M.Data() + (M.height()-1)*M.Dist() + M.width();
+  else
+    return M.Data() + (M.width()-1)*M.Dist() + M.height();
+}
 
-      std::lock_guard<std::mutex> lock(linemutex); // lock
+// do the memory areas of the two views intersect?
+template <ORDERING ORDA, ORDERING ORDB>
+bool overlaps(MatrixView<double, ORDA> A, MatrixView<double, ORDB> B)
+{
+  if (A.height() == 0 || A.width() == 0 || B.height() == 0 || B.width() == 0) return false;
+  return A.Data() < dataend(B) && B.Data() < dataend(A);
+}
 
-      Ablock = A.Rows(i1,i2-i1).Cols(j1,j2-j1);
-      
-      blockmultcachy (C.Rows(i1, i2-i1), Ablock, B.Rows(j1, j2-j1));
-    });
-  });
+// true if B is the transposed view of A, so that A*B is symmetric
+template <ORDERING ORDA, ORDERING ORDB>
+bool istransposed(MatrixView<double, ORDA> A, MatrixView<double, ORDB> B)
+{
+  return ORDA != ORDB && A.Data() == B.Data() && A.Dist() == B.Dist()
+    && A.height() == B.width() && A.width() == B.height();
+}
+
+// products with less flops are not worth distributing to the task pool
+constexpr size_t parallel_threshold = 128*128*128;
 
-  StopWorkers();
+// C += alpha*A*B, in parallel if the product is large enough
+template <ORDERING ORDA, ORDERING ORDB>
+void multauto(MatrixView<double, RowMajor> C, MatrixView<double, ORDA> A, MatrixView<double, ORDB> B, double alpha)
+{
+  if (C.height()*C.width()*A.width() >= parallel_threshold && NumThreads() > 1)
+    multparallel(C, A, B, alpha);
+  else
+    multpacked(C, A, B, alpha);
 }
 
+// C = alpha*A*B + beta*C for any ordering of C, A and B (like dgemm).
+// For op(A) = A^T or op(B) = B^T, pass A.transposed() or B.transposed(), no data is copied
+// except for the packed blocks; if C overlaps A or B, the product goes through a temporary.
+template <ORDERING ORDC, ORDERING ORDA, ORDERING ORDB>
+void multgemm(MatrixView<double, ORDC> C, MatrixView<double, ORDA> A, MatrixView<double, ORDB> B,
+              double alpha = 1.0, double beta = 0.0)
+{
+  if (A.height() != C.height() || B.width() != C.width() || A.width() != B.height())
+    throw std::invalid_argument("matrix shapes are not compatible for multiplication");
+
+  // the result would overwrite a factor: compute into a temporary first
+  if (overlaps(C, A) || overlaps(C, B))
+  {
+    Matrix<double, ORDC> tmp(C.height(), C.width());
+    multgemm(tmp.View(), A, B, alpha, 0.0);
+    if (beta == 0.0)
+      C = tmp;
+    else
+    {
+      C *= beta;
+      C += tmp;
+    }
+    return;
+  }
+
+  // beta = 0 overwrites C (even NaNs), like in BLAS
+  if (beta == 0.0)
+    C = 0.0;
+  else if (beta != 1.0)
+    C *= beta;
+
+  if constexpr (ORDC == RowMajor)
+    multauto(C, A, B, alpha);
+  else
+    multauto(C.transposed(), B.transposed(), A.transposed(), alpha); // C^T = B^T A^T, C^T is row-major
+}
 
 } // namespace
+
+// A*A^T and A^T*A go to the rank-k update, the route of the MatrixView assignments is registered there
+#include "symmetric.h"
+
 #endif
@@ -6,6 +6,9 @@ namespace Neo_CLA{
   // choice of row or column major, for template
   enum ORDERING { RowMajor, ColMajor };
 
+  // the triangle of a square matrix that holds a symmetric or triangular matrix
+  enum TRIANGLE { Lower, Upper };
+
 
   template <typename T = double, typename TDIST = std::integral_constant<size_t,1> >
   class VectorView;
@@ -13,6 +16,10 @@ namespace Neo_CLA{
 
   template <typename T = double, ORDERING ORD = RowMajor>
   class MatrixView;
+
+
+  template <typename T = double, ORDERING ORD = RowMajor>
+  class TriangularView;
 }
 
 #endif
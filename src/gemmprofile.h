@@ -0,0 +1,143 @@
+#ifndef FILE_GEMMPROFILE_H
+#define FILE_GEMMPROFILE_H
+
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+
+namespace Neo_CLA{
+
+// blocking parameters of multpacked, chosen such that a kc x nr panel of B stays in L1-Cache,
+// an mc x kc block of A in L2-Cache and a kc x nc block of B in L3-Cache
+struct GemmBlocking
+{
+  size_t mc = 96;   // rounded to a multiple of the kernel height
+  size_t kc = 256;
+  size_t nc = 3072; // rounded to a multiple of the kernel width
+  size_t tw = 384;  // width of the tiles of C that multparallel hands out to the threads (height is mc)
+};
+
+// the parameters tune_fastmult found best for one machine
+struct GemmProfile
+{
+  std::string kernel; // name of the micro-kernel, see AvailableMicroKernels()
+  GemmBlocking blocks;
+  std::optional<size_t> dot_threshold;  // length from which ddot beats Dot (BlasRoutes() in expression.h)
+  std::optional<size_t> gemv_threshold; // entries of A from which dgemv beats multgemv
+};
+
+inline std::string HostName()
+{
+#ifdef _WIN32
+  const char * name = std::getenv("COMPUTERNAME");
+  return name ? name : "localhost";
+#else
+  char name[256] = "localhost";
+  gethostname(name, sizeof(name)-1);
+  return name;
+#endif
+}
+
+// where tune_fastmult writes the profile by default: $HOME/.neo_cla_gemm_<hostname>
+// (one file per host, so nodes of a cluster sharing the home directory keep their own profile)
+inline std::string DefaultGemmProfilePath()
+{
+#ifdef _WIN32
+  const char * home = std::getenv("USERPROFILE");
+#else
+  const char * home = std::getenv("HOME");
+#endif
+  return std::string(home ? home : ".") + "/.neo_cla_gemm_" + HostName();
+}
+
+// lines of the form "key value", unknown keys and lines starting with # are skipped;
+// returns nothing if the file can't be opened
+inline std::optional<GemmProfile> ReadGemmProfile(const std::string & path)
+{
+  std::ifstream in(path);
+  if (!in) return std::nullopt;
+
+  GemmProfile profile;
+  std::string line;
+  size_t value;
+  while (std::getline(in, line))
+  {
+    std::istringstream ist(line);
+    std::string key;
+    if (!(ist >> key) || key[0] == '#') continue;
+
+    if (key == "kernel") ist >> profile.kernel;
+    else if (key == "mc") ist >> profile.blocks.mc;
+    else if (key == "kc") ist >> profile.blocks.kc;
+    else if (key == "nc") ist >> profile.blocks.nc;
+    else if (key == "tw") ist >> profile.blocks.tw;
+    else if (key == "dot_threshold" && ist >> value) profile.dot_threshold = value;
+    else if (key == "gemv_threshold" && ist >> value) profile.gemv_threshold = value;
+  }
+  return profile;
+}
+
+inline void WriteGemmProfile(const std::string & path, const GemmProfile & profile)
+{
+  std::ofstream out(path);
+  if (!out)
+    throw std::runtime_error("cannot write GEMM profile " + path);
+
+  out << "# written by tune_fastmult for " << HostName() << "\n"
+      << "kernel " << profile.kernel << "\n"
+      << "mc " << profile.blocks.mc << "\n"
+      << "kc " << profile.blocks.kc << "\n"
+      << "nc " << profile.blocks.nc << "\n"
+      << "tw " << profile.blocks.tw << "\n";
+  if (profile.dot_threshold) out << "dot_threshold " << *profile.dot_threshold << "\n";
+  if (profile.gemv_threshold) out << "gemv_threshold " << *profile.gemv_threshold << "\n";
+}
+
+// the profile named by the environment variable NEO_CLA_GEMM_PROFILE, read once at the first matrix product;
+// this is the only profile loaded implicitly, others are loaded with LoadGemmProfile (see microkernels.h)
+inline const std::optional<GemmProfile> & EnvironmentGemmProfile()
+{
+  static const std::optional<GemmProfile> profile = []() -> std::optional<GemmProfile> {
+    const char * path = std::getenv("NEO_CLA_GEMM_PROFILE");
+    if (!path) return std::nullopt;
+    return ReadGemmProfile(path);
+  }();
+  return profile;
+}
+
+inline std::mutex & GemmDefaultsMutex()
+{
+  static std::mutex mutex;
+  return mutex;
+}
+
+inline GemmBlocking & GemmDefaultsStorage()
+{
+  static GemmBlocking blocks = EnvironmentGemmProfile() ? EnvironmentGemmProfile()->blocks : GemmBlocking();
+  return blocks;
+}
+
+// the blocking used by multpacked and multparallel unless given explicitly (a copy, products read it once)
+inline GemmBlocking GemmDefaults()
+{
+  std::lock_guard<std::mutex> lock(GemmDefaultsMutex());
+  return GemmDefaultsStorage();
+}
+
+inline void SetGemmDefaults(const GemmBlocking & blocks)
+{
+  std::lock_guard<std::mutex> lock(GemmDefaultsMutex());
+  GemmDefaultsStorage() = blocks;
+}
+
+} // namespace
+#endif
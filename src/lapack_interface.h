@@ -1,12 +1,16 @@
 #ifndef FILE_LAPACK_INTERFACE_H
 #define FILE_LAPACK_INTERFACE_H
 
+#include <cstdlib>
 #include <iostream>
 #include <string>
 #include <exception>
+#include <variant>
 
 #include "vector.h"
 #include "matrix.h"
+#include "lu.h"
+#include "microkernels.h"
 
 
 
@@ -58,11 +62,176 @@ namespace Neo_CLA
    //   throw std::runtime_error(std::string("daxpy returned errcode "+std::to_string(err)));      
   }
   
-  // InnerProductLapack, NormLapack
+  // doublereal ddot_(integer *n, doublereal *dx, integer *incx, doublereal *dy, integer *incy);
+  // x^T y
+  template <typename SX, typename SY>
+  double InnerProductLapack (VectorView<double,SX> x, VectorView<double,SY> y)
+  {
+    if (x.Size() != y.Size())
+      throw std::invalid_argument("vectors need to have same length for scalar product");
+    integer n = x.Size();
+    if (n == 0) return 0;
+    integer incx = x.Dist();
+    integer incy = y.Dist();
+    return ddot_ (&n, x.Data(), &incx, y.Data(), &incy);
+  }
+
+  // doublereal dnrm2_(integer *n, doublereal *x, integer *incx);
+  // 2-norm of x
+  template <typename SX>
+  double NormLapack (VectorView<double,SX> x)
+  {
+    integer n = x.Size();
+    if (n == 0) return 0;
+    integer incx = x.Dist();
+    return dnrm2_ (&n, x.Data(), &incx);
+  }
+
+  // int dscal_(integer *n, doublereal *da, doublereal *dx, integer *incx);
+  // x *= alpha
+  template <typename SX>
+  void ScaleVectorLapack (double alpha, VectorView<double,SX> x)
+  {
+    integer n = x.Size();
+    if (n == 0) return;
+    integer incx = x.Dist();
+    dscal_ (&n, &alpha, x.Data(), &incx);
+  }
 
 
   // BLAS-2 functions:
-  // MultMatVecLapack
+  // A row-major matrix is handed to BLAS as its storage, the column-major A^T:
+  // products and solves then use the transposed operation, and the lower triangle becomes the upper one.
+
+  // int dgemv_(char *trans, integer *m, integer *n, doublereal *alpha, doublereal *a, integer *lda,
+  //            doublereal *x, integer *incx, doublereal *beta, doublereal *y, integer *incy);
+  // y = alpha a x + beta y
+  template <ORDERING ORD, typename SX, typename SY>
+  void MultMatVecLapack (MatrixView<double, ORD> a, VectorView<double,SX> x, VectorView<double,SY> y,
+                         double alpha = 1.0, double beta = 0.0)
+  {
+    if (a.width() != x.Size() || a.height() != y.Size())
+      throw std::invalid_argument("matrix shape and vector lengths are not compatible for multiplication");
+    if (y.Size() == 0) return;
+    if (x.Size() == 0)
+    {
+      // nothing to multiply, BLAS would return without touching y
+      if (beta == 0) y = 0.0;
+      else y *= beta;
+      return;
+    }
+
+    char trans = (ORD == ColMajor) ? 'N' : 'T';
+    integer m = (ORD == ColMajor) ? a.height() : a.width();
+    integer n = (ORD == ColMajor) ? a.width() : a.height();
+    integer lda = std::max(a.Dist(), 1ul);
+    integer incx = x.Dist();
+    integer incy = y.Dist();
+    dgemv_ (&trans, &m, &n, &alpha, a.Data(), &lda, x.Data(), &incx, &beta, y.Data(), &incy);
+  }
+
+  // int dger_(integer *m, integer *n, doublereal *alpha, doublereal *x, integer *incx,
+  //           doublereal *y, integer *incy, doublereal *a, integer *lda);
+  // a += alpha x y^T
+  template <ORDERING ORD, typename SX, typename SY>
+  void RankOneUpdateLapack (double alpha, VectorView<double,SX> x, VectorView<double,SY> y, MatrixView<double, ORD> a)
+  {
+    if (a.height() != x.Size() || a.width() != y.Size())
+      throw std::invalid_argument("vector lengths do not fit the matrix shape for the rank-1 update");
+    if (x.Size() == 0 || y.Size() == 0) return;
+
+    integer lda = std::max(a.Dist(), 1ul);
+    integer incx = x.Dist();
+    integer incy = y.Dist();
+    if constexpr (ORD == ColMajor)
+    {
+      integer m = a.height(), n = a.width();
+      dger_ (&m, &n, &alpha, x.Data(), &incx, y.Data(), &incy, a.Data(), &lda);
+    }
+    else
+    {
+      // a^T += alpha y x^T
+      integer m = a.width(), n = a.height();
+      dger_ (&m, &n, &alpha, y.Data(), &incy, x.Data(), &incx, a.Data(), &lda);
+    }
+  }
+
+  // int dtrsv_(char *uplo, char *trans, char *diag, integer *n, doublereal *a, integer *lda,
+  //            doublereal *x, integer *incx);
+  // x overwritten with T^{-1} x, T the lower (or upper) triangle of a, with ones on the diagonal if unit is set
+  template <ORDERING ORD, typename SX>
+  void SolveTriangularLapack (MatrixView<double, ORD> a, VectorView<double,SX> x, bool lower, bool unit = false)
+  {
+    if (a.height() != a.width() || a.width() != x.Size())
+      throw std::invalid_argument("triangular solve needs a square matrix of the vector length");
+    if (x.Size() == 0) return;
+
+    char uplo = (lower == (ORD == ColMajor)) ? 'L' : 'U';
+    char trans = (ORD == ColMajor) ? 'N' : 'T';
+    char diag = unit ? 'U' : 'N';
+    integer n = x.Size();
+    integer lda = std::max(a.Dist(), 1ul);
+    integer incx = x.Dist();
+    dtrsv_ (&uplo, &trans, &diag, &n, a.Data(), &lda, x.Data(), &incx);
+  }
+
+  // int dtrmv_(char *uplo, char *trans, char *diag, integer *n, doublereal *a, integer *lda,
+  //            doublereal *x, integer *incx);
+  // x overwritten with T x, T as in SolveTriangularLapack
+  template <ORDERING ORD, typename SX>
+  void MultTriangularLapack (MatrixView<double, ORD> a, VectorView<double,SX> x, bool lower, bool unit = false)
+  {
+    if (a.height() != a.width() || a.width() != x.Size())
+      throw std::invalid_argument("triangular product needs a square matrix of the vector length");
+    if (x.Size() == 0) return;
+
+    char uplo = (lower == (ORD == ColMajor)) ? 'L' : 'U';
+    char trans = (ORD == ColMajor) ? 'N' : 'T';
+    char diag = unit ? 'U' : 'N';
+    integer n = x.Size();
+    integer lda = std::max(a.Dist(), 1ul);
+    integer incx = x.Dist();
+    dtrmv_ (&uplo, &trans, &diag, &n, a.Data(), &lda, x.Data(), &incx);
+  }
+
+  // int dsymv_(char *uplo, integer *n, doublereal *alpha, doublereal *a, integer *lda, doublereal *x,
+  //            integer *incx, doublereal *beta, doublereal *y, integer *incy);
+  // y = alpha S x + beta y, S the symmetric matrix given by the lower (or upper) triangle of a
+  template <ORDERING ORD, typename SX, typename SY>
+  void MultSymMatVecLapack (MatrixView<double, ORD> a, VectorView<double,SX> x, VectorView<double,SY> y, bool lower,
+                            double alpha = 1.0, double beta = 0.0)
+  {
+    if (a.height() != a.width() || a.width() != x.Size() || a.height() != y.Size())
+      throw std::invalid_argument("symmetric product needs a square matrix of the vector lengths");
+    if (y.Size() == 0) return;
+
+    // S^T = S, only the stored triangle changes
+    char uplo = (lower == (ORD == ColMajor)) ? 'L' : 'U';
+    integer n = y.Size();
+    integer lda = std::max(a.Dist(), 1ul);
+    integer incx = x.Dist();
+    integer incy = y.Dist();
+    dsymv_ (&uplo, &n, &alpha, a.Data(), &lda, x.Data(), &incx, &beta, y.Data(), &incy);
+  }
+
+
+  // the routes of x*y and A*x to the BLAS (see BlasRoutes() in expression.h), set up at program start
+  // with the crossovers of the NEO_CLA_GEMM_PROFILE, if it has them
+  inline const bool blas_routes_registered = [] {
+    if (EnvironmentGemmProfile())
+      SetBlasThresholds(*EnvironmentGemmProfile());
+    BlasRoutes().dot = [](size_t n, double * x, size_t incx, double * y, size_t incy) {
+      integer n_ = n, incx_ = incx, incy_ = incy;
+      return double(ddot_ (&n_, x, &incx_, y, &incy_));
+    };
+    BlasRoutes().gemv = [](bool transposed, size_t h, size_t w, double alpha, double * a, size_t lda,
+                           double * x, size_t incx, double beta, double * y, size_t incy) {
+      char trans = transposed ? 'T' : 'N';
+      integer m = h, n = w, lda_ = lda, incx_ = incx, incy_ = incy;
+      dgemv_ (&trans, &m, &n, &alpha, a, &lda_, x, &incx_, &beta, y, &incy_);
+    };
+    return true;
+  }();
 
 
 
@@ -145,11 +314,13 @@ namespace Neo_CLA
     }
 
 
-    // b overwritten with A^{-1} b
-    void Solve (VectorView<double> b){
-      char transa =  'N';
+    // b overwritten with A^{-1} b, or with A^{-T} b if transposed is set
+    void Solve (VectorView<double> b, bool transposed = false){
+      char transa =  transposed ? 'T' : 'N';
       integer n = a.height();
       if (a.height() != a.width()) throw std::runtime_error("LapackLU.Solve needs the matrix to be quadratic");
+      if (b.Size() != a.height()) throw std::invalid_argument("LapackLU.Solve: right hand side has wrong size");
+      if (n == 0) return;
       integer nrhs = 1;
       integer lda = a.Dist();
       integer ldb = b.Size();
@@ -164,14 +335,69 @@ namespace Neo_CLA
 
       if (info != 0) throw std::runtime_error("LapackLU.Solve() dgetrs failed");
     }
+
+    // all columns of B overwritten with A^{-1} B (A^{-T} B if transposed is set), in one BLAS-3 call
+    template <ORDERING ORDB>
+    void Solve (MatrixView<double, ORDB> B, bool transposed = false){
+      integer n = a.height();
+      if (a.height() != a.width()) throw std::runtime_error("LapackLU.Solve needs the matrix to be quadratic");
+      if (B.height() != a.height()) throw std::invalid_argument("LapackLU.Solve: right hand sides have wrong height");
+      if (B.width() == 0) return;
+      // the leading dimension of the column-major storage (B, or B^T for a row-major B)
+      if (B.Dist() < std::max<size_t>(1, ORDB == ColMajor ? B.height() : B.width()))
+        throw std::invalid_argument("LapackLU.Solve: rows or columns of the right hand sides overlap");
+
+      integer nrhs = B.width();
+      integer lda = a.Dist();
+      integer ldb = B.Dist();
+      integer info = 0;
+
+      if constexpr (ORDB == ColMajor)
+      {
+        char transa = transposed ? 'T' : 'N';
+        dgetrs_(&transa, &n, &nrhs, a.Data(), &lda, (integer*)&ipiv[0], B.Data(), &ldb, &info);
+        if (info != 0) throw std::runtime_error("LapackLU.Solve() dgetrs failed");
+      }
+      else
+      {
+        // the storage of B is the column-major B^T: solve X^T A^T = B^T (or X^T A = B^T) from the right,
+        // with A = P L U: A^{-T} = P L^{-T} U^{-T}, A^{-1} = U^{-1} L^{-1} P^T
+        char right = 'R', lower = 'L', upper = 'U', notrans = 'N', trans = 'T', unit = 'U', nonunit = 'N';
+        double one = 1;
+        auto swaprows = [&](size_t k) {
+          size_t p = ipiv[k] - 1;
+          if (p != k)
+            for (size_t j = 0; j < B.width(); j++)
+              std::swap(B(k, j), B(p, j));
+        };
+
+        if (!transposed)
+        {
+          for (size_t k = 0; k < ipiv.size(); k++)
+            swaprows(k);
+          dtrsm_(&right, &lower, &trans, &unit, &nrhs, &n, &one, a.Data(), &lda, B.Data(), &ldb);
+          dtrsm_(&right, &upper, &trans, &nonunit, &nrhs, &n, &one, a.Data(), &lda, B.Data(), &ldb);
+        }
+        else
+        {
+          dtrsm_(&right, &upper, &notrans, &nonunit, &nrhs, &n, &one, a.Data(), &lda, B.Data(), &ldb);
+          dtrsm_(&right, &lower, &notrans, &unit, &nrhs, &n, &one, a.Data(), &lda, B.Data(), &ldb);
+          for (size_t k = ipiv.size(); k-- > 0; )
+            swaprows(k);
+        }
+      }
+    }
   
 
-    Matrix<double,ColMajor> Inverse() {
+    // dgetri works in place, so on a copy: the factors (and views of them) stay valid
+    Matrix<double,ColMajor> Inverse() const {
       double hwork;
       integer lwork = -1;
       integer n = a.height();
       if (a.height() != a.width()) throw std::runtime_error("LapackLU.Inverse() needs the matrix to be quadratic");
-      integer lda = a.Dist();
+      Matrix<double, ColMajor> inv(a);
+      integer * piv = const_cast<integer*> (ipiv.data());
+      integer lda = inv.Dist();
       integer info;
       /*
       https://netlib.org/lapack/explore-html/dd/d9a/group__double_g_ecomputational_ga56d9c860ce4ce42ded7f914fdb0683ff.html#ga56d9c860ce4ce42ded7f914fdb0683ff
@@ -179,87 +405,103 @@ namespace Neo_CLA
                   integer *ipiv, doublereal *work, integer *lwork, 
                   integer *info);
       */       
-      dgetri_(&n, a.Data(), &lda, &ipiv[0], &hwork, &lwork, &info);
+      dgetri_(&n, inv.Data(), &lda, piv, &hwork, &lwork, &info);
       if (info != 0) throw std::runtime_error("LapackLU.Inverse() first dgetri failed");
       lwork = integer(hwork);
       std::vector<double> work(lwork);
-      dgetri_(&n, a.Data(), &lda, &ipiv[0], &work[0], &lwork, &info);
+      dgetri_(&n, inv.Data(), &lda, piv, &work[0], &lwork, &info);
       if (info != 0) throw std::runtime_error("LapackLU.Inverse() second dgetri failed");
 
-      return std::move(a);
+      return inv;
     }
 
-    /*
-    Matrix<double,ORD> LFactor() const { ... }
-    Matrix<double,ORD> UFactor() const { ... }
-    Matrix<double,ORD> PFactor() const { ... }
-    */
-    
     // copies lower triangular matrix
     Matrix<double, ColMajor> LFactor() const {
       Matrix<double, ColMajor> L(a.height(), a.width());
-      for (size_t i = 0; i < a.height(); i++) {
-        for (size_t j = 0; j < a.width(); j++) {
-          if (i > j)
-            L(i, j) = a(i, j);
-          else if (i == j)
-            L(i, j) = 1;
-          else
-            L(i, j) = 0;
-        }
-      }
+      for (size_t j = 0; j < a.width(); j++)
+        for (size_t i = 0; i < a.height(); i++)
+          L(i, j) = i > j ? a(i, j) : (i == j ? 1 : 0);
       return L;
     }
 
     Matrix<double, ColMajor> UFactor() const {
       Matrix<double, ColMajor> U(a.height(), a.width());
-      for (size_t i = 0; i < a.height(); i++) {
-        for (size_t j = 0; j < a.width(); j++) {
-          if (i <= j)
-            U(i, j) = a(i, j);
-          else
-            U(i, j) = 0;
-        }
-      }
+      for (size_t j = 0; j < a.width(); j++)
+        for (size_t i = 0; i < a.height(); i++)
+          U(i, j) = i <= j ? a(i, j) : 0;
       return U;
     }
 
+    // A = P L U; ipiv lists row exchanges, not the permutation itself, see PermutationView::Indices
     Matrix<double, ColMajor> PFactor() const {
-      Matrix<double, ColMajor> P(a.height(), a.width());
-
-      /* From the internet: The ipiv array is an array that lists row interchanges,
-      it is not a true pivot vector.
-      More on that:
-        https://stackoverflow.com/questions/45122804/is-there-an-algorithm-that-changes-lapack-permutation-to-a-real-permutation
-        https://community.intel.com/t5/Intel-oneAPI-Math-Kernel-Library/Strange-partial-pivoting-of-LAPACKE-dgetrf/m-p/1143469
-      
-      permut is the vector we really want, it also shifts the indices to the
-      range from 0 to n - 1
-      */
-      std::vector<integer> permut(ipiv.size());
-
-      for (size_t i = 0; i < permut.size(); i++){
-        permut[i] = i;
-      }
+      std::vector<size_t> permut = PView().Indices();
+      Matrix<double, ColMajor> P(a.height(), a.height());
+      P = 0.0;
+      for (size_t k = 0; k < permut.size(); k++)
+        P(permut[k], k) = 1;
+      return P;
+    }
 
-      integer tmp = 0;
-      for (size_t i = 0; i < ipiv.size(); i++){
-        tmp = permut[i];
-        permut[i] = permut[ipiv[i] - 1];
-        permut[ipiv[i] - 1] = tmp;
-      }
+    // L, U and P of A = P L U referencing the factorization, nothing is copied
+    TriangularView<double, ColMajor> LView() const {
+      if (a.height() != a.width()) throw std::runtime_error("LapackLU.LView needs the matrix to be quadratic");
+      return TriangularView<double, ColMajor>(a.View(), Lower, true);
+    }
+    TriangularView<double, ColMajor> UView() const {
+      if (a.height() != a.width()) throw std::runtime_error("LapackLU.UView needs the matrix to be quadratic");
+      return TriangularView<double, ColMajor>(a.View(), Upper);
+    }
+    // the ipiv of dgetrf counts from 1
+    PermutationView<integer> PView() const {
+      return PermutationView<integer>(a.height(), ipiv.data(), std::min(a.height(), a.width()), 1);
+    }
+  };
 
-      for (size_t i = 0; i < permut.size(); i++) {
-        for (size_t j = 0; j < a.width(); j++) {
-          if (i == permut[j])
-            P(i, j) = 1;
-          else
-            P(i, j) = 0;
-        }
-      }
-      return P;
+  // LU factorization by LAPACK (dgetrf) or by the native implementation of lu.h
+  enum LU_BACKEND { LapackBackend, NativeBackend };
+
+  // the backend of LUFactorization unless given explicitly,
+  // initially NativeBackend if the environment variable NEO_CLA_LU_BACKEND is "native"
+  inline LU_BACKEND & DefaultLUBackend() {
+    static LU_BACKEND backend = [](){
+      const char * name = std::getenv("NEO_CLA_LU_BACKEND");
+      return (name && std::string(name) == "native") ? NativeBackend : LapackBackend;
+    }();
+    return backend;
+  }
 
+  // LapackLU or NativeLU, chosen at runtime, with the same interface
+  template <ORDERING ORD>
+  class LUFactorization {
+    std::variant<LapackLU<ORD>, NativeLU<ORD>> lu;
+
+    static std::variant<LapackLU<ORD>, NativeLU<ORD>> Factor (Matrix<double, ORD> a, LU_BACKEND backend) {
+      if (backend == NativeBackend)
+        return NativeLU<ORD>(std::move(a));
+      return LapackLU<ORD>(std::move(a));
+    }
+
+   public:
+    LUFactorization (Matrix<double, ORD> a, LU_BACKEND backend = DefaultLUBackend())
+      : lu(Factor(std::move(a), backend)) {;}
+
+    LU_BACKEND Backend() const { return lu.index() == 0 ? LapackBackend : NativeBackend; }
+
+    void Solve (VectorView<double> b, bool transposed = false) {
+      std::visit([&](auto & f) { f.Solve(b, transposed); }, lu);
+    }
+    template <ORDERING ORDB>
+    void Solve (MatrixView<double, ORDB> B, bool transposed = false) {
+      std::visit([&](auto & f) { f.Solve(B, transposed); }, lu);
     }
+    Matrix<double, ColMajor> Inverse() const { return std::visit([](auto & f) { return f.Inverse(); }, lu); }
+    Matrix<double, ColMajor> LFactor() const { return std::visit([](auto & f) { return f.LFactor(); }, lu); }
+    Matrix<double, ColMajor> UFactor() const { return std::visit([](auto & f) { return f.UFactor(); }, lu); }
+    Matrix<double, ColMajor> PFactor() const { return std::visit([](auto & f) { return f.PFactor(); }, lu); }
+
+    // f(LapackLU<ORD> &) or f(NativeLU<ORD> &), e.g. for the views LView(), UView() and PView() of the backend
+    template <typename FUNC>
+    decltype(auto) Visit (FUNC && f) { return std::visit(std::forward<FUNC>(f), lu); }
   };
 
   /*
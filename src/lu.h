@@ -0,0 +1,387 @@
+#ifndef FILE_LU_H
+#define FILE_LU_H
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "fastmult.h"
+#include "matrix.h"
+#include "triangular.h"
+
+
+namespace Neo_CLA{
+
+// Dense LU factorization and inversion, formulated recursively so that almost all flops are
+// spent in matrix products on large blocks, which run on the kernels of fastmult.h (and on the
+// task pool, see multauto). Only blocks of at most lu_base rows or columns are processed
+// with plain loops. The triangular solves and products are those of triangular.h.
+
+constexpr size_t lu_base = 16;       // width of the panels factored column by column
+constexpr size_t inverse_block = 64; // width of the column blocks of InvertFromLU
+
+
+template <ORDERING ORD>
+void SwapRows(MatrixView<double, ORD> A, size_t i, size_t j)
+{
+  for (size_t k = 0; k < A.width(); k++)
+    std::swap(A(i, k), A(j, k));
+}
+
+
+// inverts the upper triangular part of U in place:
+// [U11 U12; 0 U22]^{-1} = [U11^{-1}, -U11^{-1} U12 U22^{-1}; 0, U22^{-1}]
+template <ORDERING ORD>
+void InvertUpper(MatrixView<double, ORD> U)
+{
+  size_t k = U.height();
+  if (k <= lu_base)
+  {
+    for (size_t j = 0; j < k; j++)
+    {
+      U(j, j) = 1 / U(j, j);
+      // column j above the diagonal: -U(j,j) times the inverted upper left block times the column
+      for (size_t i = 0; i < j; i++)
+      {
+        double sum = 0;
+        for (size_t p = i; p < j; p++)
+          sum += U(i, p) * U(p, j);
+        U(i, j) = -U(j, j) * sum;
+      }
+    }
+    return;
+  }
+
+  size_t k1 = k/2, k2 = k-k1;
+  auto U12 = Block(U, 0, k1, k1, k2);
+  InvertUpper(Block(U, 0, 0, k1, k1));
+  InvertUpper(Block(U, k1, k1, k2, k2));
+  multtrmm(TriangularView(Block(U, 0, 0, k1, k1), Upper), U12, -1.0);
+  multtrmm(U12, TriangularView(Block(U, k1, k1, k2, k2), Upper));
+}
+
+
+// LU factorization with partial pivoting of the columns [first, first+w) of A, below row first.
+// The columns left of first are already factored. Row exchanges are applied to complete rows,
+// row k is exchanged with row piv[k]. The left half of the panel is factored first, then the right
+// half is updated with a triangular solve and a matrix product, and factored.
+template <ORDERING ORD>
+void LUFactorColumns(MatrixView<double, ORD> A, size_t first, size_t w, std::vector<size_t> & piv)
+{
+  size_t m = A.height();
+  if (w <= lu_base)
+  {
+    for (size_t k = first; k < first+w; k++)
+    {
+      size_t p = k;
+      double maxval = std::abs(A(k, k));
+      for (size_t i = k+1; i < m; i++)
+        if (std::abs(A(i, k)) > maxval)
+        {
+          maxval = std::abs(A(i, k));
+          p = i;
+        }
+
+      if (maxval == 0)
+        throw std::logic_error("matrix is not invertible");
+
+      piv[k] = p;
+      if (p != k) SwapRows(A, k, p);
+
+      double inv = 1 / A(k, k);
+      for (size_t i = k+1; i < m; i++)
+      {
+        A(i, k) *= inv;
+        for (size_t j = k+1; j < first+w; j++)
+          A(i, j) -= A(i, k) * A(k, j);
+      }
+    }
+    return;
+  }
+
+  size_t w1 = w/2, w2 = w-w1;
+  LUFactorColumns(A, first, w1, piv);
+  multtrsm(TriangularView(Block(A, first, first, w1, w1), Lower, true), Block(A, first, first+w1, w1, w2));
+  MultAddBlocks(Block(A, first+w1, first+w1, m-first-w1, w2),
+                Block(A, first+w1, first, m-first-w1, w1),
+                Block(A, first, first+w1, w1, w2), -1.0);
+  LUFactorColumns(A, first+w1, w2, piv);
+}
+
+// P A = L U in place (L unit lower triangular below the diagonal, U upper triangular),
+// P exchanges row k with row piv[k] for k = 0, 1, ...
+template <ORDERING ORD>
+std::vector<size_t> LUFactor(MatrixView<double, ORD> A)
+{
+  if (A.height() < A.width())
+    throw std::invalid_argument("LUFactor needs at least as many rows as columns");
+
+  std::vector<size_t> piv(A.width());
+  LUFactorColumns(A, 0, A.width(), piv);
+  return piv;
+}
+
+// A^{-1} = U^{-1} L^{-1} P in place, from the output of LUFactor.
+// U is inverted first, then X L = U^{-1} is solved for X by blocks of columns from right to left:
+// the columns of L are moved to a buffer of inverse_block columns, the rest are matrix products.
+template <ORDERING ORD>
+void InvertFromLU(MatrixView<double, ORD> A, const std::vector<size_t> & piv)
+{
+  size_t n = A.height();
+  if (n == 0) return;
+
+  InvertUpper(A);
+
+  Matrix<double, ORD> W(n, std::min(n, inverse_block));
+  for (size_t j = (n-1) / inverse_block * inverse_block; ; j -= inverse_block)
+  {
+    size_t jb = std::min(inverse_block, n-j);
+
+    for (size_t c = 0; c < jb; c++)
+      for (size_t i = j+c+1; i < n; i++)
+      {
+        W(i, c) = A(i, j+c);
+        A(i, j+c) = 0;
+      }
+
+    auto X = A.Cols(j, jb);
+    MultAddBlocks(X, A.Cols(j+jb, n-j-jb), Block(W.View(), j+jb, 0, n-j-jb, jb), -1.0);
+    multtrsm(X, TriangularView(Block(W.View(), j, 0, jb, jb), Lower, true));
+
+    if (j == 0) break;
+  }
+
+  // the column exchanges of P, in reverse order
+  if constexpr (ORD == RowMajor)
+  {
+    ParallelBlocks(n, n, [&](size_t first, size_t next) {
+      for (size_t i = first; i < next; i++)
+        for (size_t k = n; k-- > 0; )
+          std::swap(A(i, k), A(i, piv[k]));
+    });
+  }
+  else
+  {
+    for (size_t k = n; k-- > 0; )
+      if (piv[k] != k) A.swapcols(k, piv[k]);
+  }
+}
+
+// the permutation P of A = P L U, referencing the row exchanges of a factorization in place:
+// P is height x height, row k was exchanged with row piv[k] - base for k < exchanges
+// (base 1 for the ipiv of LAPACK, 0 for LUFactor)
+template <typename TI = size_t>
+class PermutationView
+{
+  size_t height_;
+  const TI * piv_;
+  size_t exchanges_;
+  size_t base_;
+
+ public:
+  PermutationView (size_t height, const TI * piv, size_t exchanges, size_t base = 0)
+    : height_(height), piv_(piv), exchanges_(exchanges), base_(base) {;}
+
+  size_t Size() const { return height_; }
+  size_t Exchanges() const { return exchanges_; }
+
+  // the row that was exchanged with row k
+  size_t Exchange(size_t k) const { return size_t(piv_[k]) - base_; }
+
+  // x := P x, or P^T x if transposed is set (the exchanges in reverse order, or in order)
+  template <typename TDIST>
+  void Apply (VectorView<double, TDIST> x, bool transposed = false) const
+  {
+    if (x.Size() != height_) throw std::invalid_argument("PermutationView.Apply: vector has wrong size");
+    for (size_t i = 0; i < exchanges_; i++)
+    {
+      size_t k = transposed ? i : exchanges_-1-i;
+      std::swap(x(k), x(Exchange(k)));
+    }
+  }
+
+  // the same for all columns of X, O(n) per column
+  template <ORDERING ORD>
+  void Apply (MatrixView<double, ORD> X, bool transposed = false) const
+  {
+    if (X.height() != height_) throw std::invalid_argument("PermutationView.Apply: matrix has wrong height");
+    if constexpr (ORD == ColMajor)
+    {
+      for (size_t j = 0; j < X.width(); j++)
+        Apply(X.Col(j), transposed);
+    }
+    else
+    {
+      for (size_t i = 0; i < exchanges_; i++)
+      {
+        size_t k = transposed ? i : exchanges_-1-i;
+        if (Exchange(k) != k) SwapRows(X, k, Exchange(k));
+      }
+    }
+  }
+
+  // row k of P^T A = L U is row Indices()[k] of A, so P has its ones at (Indices()[k], k)
+  std::vector<size_t> Indices() const
+  {
+    std::vector<size_t> perm(height_);
+    for (size_t k = 0; k < height_; k++)
+      perm[k] = k;
+    for (size_t k = 0; k < exchanges_; k++)
+      std::swap(perm[k], perm[Exchange(k)]);
+    return perm;
+  }
+};
+
+// the solution of L x = b for the lower triangular part of L (unit diagonal if unit is set), overwriting b
+template <ORDERING ORD, typename TDIST>
+void SolveLower(MatrixView<double, ORD> L, VectorView<double, TDIST> b, bool unit)
+{
+  for (size_t i = 0; i < L.height(); i++)
+  {
+    double sum = b(i);
+    for (size_t p = 0; p < i; p++)
+      sum -= L(i, p) * b(p);
+    b(i) = unit ? sum : sum / L(i, i);
+  }
+}
+
+// the solution of U x = b for the upper triangular part of U, overwriting b
+template <ORDERING ORD, typename TDIST>
+void SolveUpper(MatrixView<double, ORD> U, VectorView<double, TDIST> b, bool unit)
+{
+  for (size_t i = U.height(); i-- > 0; )
+  {
+    double sum = b(i);
+    for (size_t p = i+1; p < U.height(); p++)
+      sum -= U(i, p) * b(p);
+    b(i) = unit ? sum : sum / U(i, i);
+  }
+}
+
+// inverts A in place, the only extra memory is a buffer of inverse_block columns
+template <ORDERING ORD>
+void InvertInPlace(MatrixView<double, ORD> A)
+{
+  if (A.width() != A.height())
+    throw std::invalid_argument("non-quadratic matrices cannot be inverted");
+
+  InvertFromLU(A, LUFactor(A));
+}
+
+// the route of Inverse (see matrix.h) for double matrices of any ordering and allocator,
+// pass an rvalue (Inverse(std::move(M))) to invert the storage of M in place
+inline const bool invert_route_registered = [] {
+  KernelRoutes().invert = [](MatrixView<double, RowMajor> A) { InvertInPlace(A); };
+  return true;
+}();
+
+
+
+// LU factorization computed by LUFactor, with the interface of LapackLU (see lapack_interface.h)
+// but without any dependency on an external LAPACK
+template <ORDERING ORD>
+class NativeLU {
+  Matrix<double, ORD> a;
+  std::vector<size_t> piv;
+
+ public:
+  NativeLU (Matrix<double, ORD> _a)
+    : a(std::move(_a))
+  {
+    if (a.height() == 0 || a.width() == 0) throw std::invalid_argument("for LU, you need a matrix!");
+    piv = LUFactor(a.View());
+  }
+
+  // b overwritten with A^{-1} b, or with A^{-T} b if transposed is set
+  void Solve (VectorView<double> b, bool transposed = false) {
+    if (a.height() != a.width()) throw std::runtime_error("NativeLU.Solve needs the matrix to be quadratic");
+    if (b.Size() != a.height()) throw std::invalid_argument("NativeLU.Solve: vector has wrong size");
+
+    // P A = L U, A^T = U^T L^T P
+    if (!transposed)
+    {
+      PView().Apply(b, true);
+      SolveLower(a.View(), b, true);
+      SolveUpper(a.View(), b, false);
+    }
+    else
+    {
+      SolveLower(a.View().transposed(), b, false);
+      SolveUpper(a.View().transposed(), b, true);
+      PView().Apply(b);
+    }
+  }
+
+  // all columns of B overwritten with A^{-1} B (A^{-T} B), the work is done by matrix products
+  template <ORDERING ORDB>
+  void Solve (MatrixView<double, ORDB> B, bool transposed = false) {
+    if (a.height() != a.width()) throw std::runtime_error("NativeLU.Solve needs the matrix to be quadratic");
+    if (B.height() != a.height()) throw std::invalid_argument("NativeLU.Solve: right hand sides have wrong height");
+
+    if (!transposed)
+    {
+      PView().Apply(B, true);
+      multtrsm(LView(), B);
+      multtrsm(UView(), B);
+    }
+    else
+    {
+      multtrsm(UView().transposed(), B);
+      multtrsm(LView().transposed(), B);
+      PView().Apply(B);
+    }
+  }
+
+  Matrix<double, ColMajor> Inverse() const {
+    if (a.height() != a.width()) throw std::runtime_error("NativeLU.Inverse() needs the matrix to be quadratic");
+    Matrix<double, ColMajor> inv(a);
+    InvertFromLU(inv.View(), piv);
+    return inv;
+  }
+
+  // copies lower triangular matrix
+  Matrix<double, ColMajor> LFactor() const {
+    Matrix<double, ColMajor> L(a.height(), a.width());
+    for (size_t j = 0; j < a.width(); j++)
+      for (size_t i = 0; i < a.height(); i++)
+        L(i, j) = i > j ? a(i, j) : (i == j ? 1 : 0);
+    return L;
+  }
+
+  Matrix<double, ColMajor> UFactor() const {
+    Matrix<double, ColMajor> U(a.height(), a.width());
+    for (size_t j = 0; j < a.width(); j++)
+      for (size_t i = 0; i < a.height(); i++)
+        U(i, j) = i <= j ? a(i, j) : 0;
+    return U;
+  }
+
+  // A = P L U, as for LapackLU
+  Matrix<double, ColMajor> PFactor() const {
+    std::vector<size_t> permut = PView().Indices();
+    Matrix<double, ColMajor> P(a.height(), a.height());
+    P = 0.0;
+    for (size_t k = 0; k < permut.size(); k++)
+      P(permut[k], k) = 1;
+    return P;
+  }
+
+  // L, U and P of A = P L U referencing the factorization, nothing is copied
+  TriangularView<double, ORD> LView() const {
+    if (a.height() != a.width()) throw std::runtime_error("NativeLU.LView needs the matrix to be quadratic");
+    return TriangularView<double, ORD>(a.View(), Lower, true);
+  }
+  TriangularView<double, ORD> UView() const {
+    if (a.height() != a.width()) throw std::runtime_error("NativeLU.UView needs the matrix to be quadratic");
+    return TriangularView<double, ORD>(a.View(), Upper);
+  }
+  PermutationView<size_t> PView() const { return PermutationView<size_t>(a.height(), piv.data(), piv.size()); }
+
+  // row k was exchanged with row Pivots()[k] (counting from 0)
+  const std::vector<size_t> & Pivots() const { return piv; }
+};
+
+} // namespace
+#endif
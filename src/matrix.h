@@ -4,6 +4,7 @@
 #include <iostream>
 #include <initializer_list>
 #include <exception>
+#include <memory>
 #include <random>
 
 #include "forward_decl.h"
@@ -48,6 +49,13 @@ class MatrixView : public MatrixExpr<MatrixView<T, ORD> >
       throw std::invalid_argument("setting matrixview to matrixexpr of different size not supported");
     }
 
+    // products of double matrices are computed by the blocked kernels if fastmult.h is included
+    if constexpr (std::is_same<T, double>::value && is_prod_matrix_expr<TB>::value) {
+      const TB & prod = static_cast<const TB&> (M);
+      if (AssignProduct(*this, prod.Left(), prod.Right()))
+        return *this;
+    }
+
     for (size_t i = 0; i < height_; i++) {
       for (size_t j = 0; j < width_; j++) {
         if constexpr (ORD == RowMajor) {
@@ -87,6 +95,12 @@ class MatrixView : public MatrixExpr<MatrixView<T, ORD> >
       throw std::invalid_argument("setting matrixview to matrixexpr of different size not supported");
     }
 
+    if constexpr (std::is_same<T, double>::value && is_prod_matrix_expr<TB>::value) {
+      const TB & prod = static_cast<const TB&> (M);
+      if (AssignProduct(*this, prod.Left(), prod.Right(), true))
+        return *this;
+    }
+
     for (size_t i = 0; i < height_; i++) {
       for (size_t j = 0; j < width_; j++) {
         if constexpr (ORD == RowMajor) {
@@ -146,7 +160,7 @@ class MatrixView : public MatrixExpr<MatrixView<T, ORD> >
   }
 
   // returns new view to current object
-  auto View() const { return MatrixView(height_, width_, data_); }
+  auto View() const { return MatrixView(height_, width_, dist_, data_); }
 
   // returns dimensions of matrix
   size_t height() const { return this->height_; };
@@ -259,7 +273,9 @@ class MatrixView : public MatrixExpr<MatrixView<T, ORD> >
 };
 
 
-template <typename T = double, ORDERING ORD = RowMajor>
+// ALLOC provides the memory, 64-byte aligned by default (see allocator.h);
+// PoolAllocator<T> reuses the memory of previous matrices of the same size
+template <typename T = double, ORDERING ORD = RowMajor, typename ALLOC = AlignedAllocator<T> >
 class Matrix : public MatrixView<T, ORD> {
   typedef MatrixView<T, ORD> BASE;
   using BASE::data_;
@@ -267,10 +283,17 @@ class Matrix : public MatrixView<T, ORD> {
   using BASE::width_;
   using BASE::dist_;
 
+  static T * Allocate (size_t size)
+  {
+    T * data = ALLOC().allocate(size);
+    std::uninitialized_default_construct_n(data, size);
+    return data;
+  }
+
  public:
   // constructor
   Matrix(size_t height, size_t width)
-    : MatrixView<T, ORD> (height, width, new T[height*width]) {;}
+    : MatrixView<T, ORD> (height, width, Allocate(height*width)) {;}
 
   // copy constructor
   Matrix (const Matrix & A)
@@ -292,7 +315,7 @@ class Matrix : public MatrixView<T, ORD> {
   // constructor from MatrixExpr
   template <typename TB>
   Matrix (const MatrixExpr<TB> & B)
-    : Matrix<T, ORD> (B.height(), B.width()) {
+    : Matrix (B.height(), B.width()) {
     
     *this = B;
 
@@ -306,30 +329,27 @@ class Matrix : public MatrixView<T, ORD> {
   
   // initializer list constructor
   Matrix (size_t height, size_t width, std::initializer_list<T> list)
-    : MatrixView<T, ORD> (height, width, new T[list.size()]) {
+    : Matrix (height, width) {
     // check if list has the right size
     if (list.size() != height_*width_){
       throw std::invalid_argument("initializer list does not have right length for matrix shape");
-      return;
     }else{
       // copy list
       for (size_t i = 0; i < list.size(); i++){
         data_[i] = list.begin()[i];
       }
     }
-
-    // set dist_
-    if constexpr (ORD == RowMajor){
-      dist_ = width;
-    }else{
-      dist_ = height;
-    }
   }
 
 
 
   // destructor
-  ~Matrix () { delete [] data_; }
+  ~Matrix ()
+  {
+    if (!data_) return;
+    std::destroy_n(data_, height_*width_);
+    ALLOC().deallocate(data_, height_*width_);
+  }
 
   // assignment operator
   using BASE::operator=;
@@ -366,6 +386,107 @@ class Matrix : public MatrixView<T, ORD> {
 };
 
 
+// fixed-size matrix, row-major
+// Like Vec, the shape is known at compile time: the products of small matrices and vectors are
+// fully unrolled and need neither heap memory nor size checks.
+template <int H, int W, typename T = double>
+class Mat : public MatrixExpr<Mat<H, W, T> >
+{
+  Vec<H*W, T> data_;
+
+ public:
+  static constexpr bool owns_data = true;
+
+  constexpr Mat () : data_() { }
+
+  constexpr Mat (const Mat & A) = default;
+
+  constexpr Mat (T all) : data_(all) { }
+
+  // the entries row by row: Mat<2,2> A = {1, 2, 3, 4}
+  template <typename ...TS, typename = std::enable_if_t<(sizeof...(TS) == H*W && H*W > 1 &&
+                                                          std::conjunction_v<std::is_convertible<TS, T>...>)> >
+  constexpr Mat (TS ... vals) : data_(T(vals)...) { }
+
+  template <typename TB>
+  constexpr Mat (const MatrixExpr<TB> & B) : data_()
+  {
+    *this = B;
+  }
+
+  constexpr Mat & operator= (const Mat & A) = default;
+
+  template <typename TB>
+  constexpr Mat & operator= (const MatrixExpr<TB> & B)
+  {
+    assert(B.height() == H && B.width() == W);
+    Unroll<H>([&](size_t i) {
+      Unroll<W>([&](size_t j) { (*this)(i, j) = B(i, j); });
+    });
+    return *this;
+  }
+
+  template <typename TB>
+  constexpr Mat & operator+= (const MatrixExpr<TB> & B)
+  {
+    assert(B.height() == H && B.width() == W);
+    Unroll<H>([&](size_t i) {
+      Unroll<W>([&](size_t j) { (*this)(i, j) += B(i, j); });
+    });
+    return *this;
+  }
+
+  constexpr Mat & operator*= (T scal)
+  {
+    data_ *= scal;
+    return *this;
+  }
+
+  constexpr const T & operator() (size_t i, size_t j) const { return data_(i*W+j); }
+  constexpr T & operator() (size_t i, size_t j) { return data_(i*W+j); }
+
+  constexpr size_t height() const { return H; }
+  constexpr size_t width() const { return W; }
+  T * Data() { return data_.Data(); }
+};
+
+// the products of fixed-size operands, preferred over the general expressions
+template <int H, int W, typename T>
+constexpr Vec<H, T> operator* (const Mat<H, W, T> & A, const Vec<W, T> & x)
+{
+  Vec<H, T> y;
+  Unroll<H>([&](size_t i) {
+    T sum = 0;
+    Unroll<W>([&](size_t j) { sum += A(i, j) * x(j); });
+    y(i) = sum;
+  });
+  return y;
+}
+
+// row i of C is the combination of the rows of B, which vectorizes over the columns
+template <int H, int K, int W, typename T>
+constexpr Mat<H, W, T> operator* (const Mat<H, K, T> & A, const Mat<K, W, T> & B)
+{
+  Mat<H, W, T> C;
+  Unroll<H>([&](size_t i) {
+    Unroll<K>([&](size_t k) {
+      Unroll<W>([&](size_t j) { C(i, j) += A(i, k) * B(k, j); });
+    });
+  });
+  return C;
+}
+
+template <int H, int W, typename T>
+constexpr Mat<W, H, T> Transpose (const Mat<H, W, T> & A)
+{
+  Mat<W, H, T> At;
+  Unroll<H>([&](size_t i) {
+    Unroll<W>([&](size_t j) { At(j, i) = A(i, j); });
+  });
+  return At;
+}
+
+
 // for testing purposes
 template<ORDERING ORD = RowMajor>
 Matrix<double, ORD> randommatrix (size_t height, size_t width, int lbound = 0, int hbound = 100)
@@ -387,9 +508,151 @@ Matrix<double, ORD> randommatrix (size_t height, size_t width, int lbound = 0, i
 }
 
 
+// output stream operator (without variadic templates)
 template <typename T, ORDERING ORD>
-Matrix<T, ORD> Inverse (const Matrix<T, ORD> & M) {
-	/*	
+std::ostream & operator<< (std::ostream & ost, const MatrixView<T, ORD> & A){
+  if ((A.width() > 0) && (A.height() > 0)){
+    for (size_t i = 0; i < A.height(); i++){
+      ost << "(";
+      for (size_t j = 0; j < A.width(); j++){
+        // matrix elements are separated by tabs
+        ost << A(i, j) << "\t";
+      }
+      ost << ")" << std::endl;
+    }
+  }else{
+    ost << "empty matrix";
+  }
+  ost << std::endl;
+  return ost;
+}
+
+
+// Products of double matrices are computed by the blocked kernels once fastmult.h (matrix products) and
+// matvec.h (matrix-vector products) are included, which register themselves here, and Inverse goes to the
+// LU factorization of lu.h. Without them, the expressions are evaluated entry by entry and Inverse uses
+// Gauss-Jordan elimination, so matrix.h does not pull in the kernels and the task pool setup.
+struct KernelDispatch
+{
+  // C = alpha*op(A)*op(B) + beta*C, op(A) is A^T if transa is set
+  void (*gemm)(MatrixView<double, RowMajor> C, MatrixView<double, RowMajor> A, bool transa,
+               MatrixView<double, RowMajor> B, bool transb, double alpha, double beta) = nullptr;
+  // y = alpha*op(A)*x + beta*y
+  void (*gemv)(VectorView<double, size_t> y, MatrixView<double, RowMajor> A, bool transa,
+               VectorView<double, size_t> x, double alpha, double beta) = nullptr;
+  // A overwritten with its inverse
+  void (*invert)(MatrixView<double, RowMajor> A) = nullptr;
+};
+
+inline KernelDispatch & KernelRoutes()
+{
+  static KernelDispatch routes;
+  return routes;
+}
+
+// the storage of A as a row-major matrix, which is A^T for a column-major A
+template <ORDERING ORD>
+MatrixView<double, RowMajor> RowMajorStorage(MatrixView<double, ORD> A)
+{
+  if constexpr (ORD == RowMajor)
+    return A;
+  else
+    return A.transposed();
+}
+
+template <ORDERING ORD>
+bool IsColMajor(MatrixView<double, ORD>) { return ORD == ColMajor; }
+
+// C = alpha*A*B (or C += alpha*A*B if add is set) for the factors of a ProdMatrixExpr, called by the
+// assignment operators of MatrixView; returns false if no kernel is registered
+template <ORDERING ORDC, typename TA, typename TB>
+bool AssignProduct(MatrixView<double, ORDC> C, const TA & A, const TB & B, bool add = false, double alpha = 1.0)
+{
+  if (!KernelRoutes().gemm) return false;
+
+  // scalar factors go into alpha, other expressions are evaluated once
+  if constexpr (is_scal_matrix_expr<TA>::value)
+    return AssignProduct(C, A.Mat(), B, add, alpha*A.Scal());
+  else if constexpr (is_scal_matrix_expr<TB>::value)
+    return AssignProduct(C, A, B.Mat(), add, alpha*B.Scal());
+  else if constexpr (!is_double_matrix_view<TA>::value)
+  {
+    Matrix<double, RowMajor> Aeval(A);
+    return AssignProduct(C, Aeval, B, add, alpha);
+  }
+  else if constexpr (!is_double_matrix_view<TB>::value)
+  {
+    Matrix<double, RowMajor> Beval(B);
+    return AssignProduct(C, A, Beval, add, alpha);
+  }
+  else
+  {
+    bool colA = IsColMajor(A.View()), colB = IsColMajor(B.View());
+    double beta = add ? 1.0 : 0.0;
+    // a column-major C is the row-major C^T = B^T A^T
+    if constexpr (ORDC == RowMajor)
+      KernelRoutes().gemm(C, RowMajorStorage(A.View()), colA, RowMajorStorage(B.View()), colB, alpha, beta);
+    else
+      KernelRoutes().gemm(C.transposed(), RowMajorStorage(B.View()), !colB,
+                          RowMajorStorage(A.View()), !colA, alpha, beta);
+    return true;
+  }
+}
+
+// y = alpha*A*x + beta*y for the factors of a ProdMatVecExpr; returns false if no kernel is registered
+template <typename SY, typename TA, typename TB>
+bool AssignMatVec(VectorView<double, SY> y, const TA & A, const TB & x, double alpha, double beta)
+{
+  if (!KernelRoutes().gemv) return false;
+
+  // scalar factors go into alpha, other expressions are evaluated once
+  if constexpr (is_scal_matrix_expr<TA>::value)
+    return AssignMatVec(y, A.Mat(), x, alpha*A.Scal(), beta);
+  else if constexpr (!is_double_matrix_view<TA>::value)
+  {
+    Matrix<double, RowMajor> Aeval(A);
+    return AssignMatVec(y, Aeval.View(), x, alpha, beta);
+  }
+  else if constexpr (!is_double_vector_view<TB>::value)
+  {
+    Vector<double> xeval(x);
+    return AssignMatVec(y, A, xeval.View(), alpha, beta);
+  }
+  else
+  {
+    auto xview = x.View();
+    VectorView<double, size_t> ys(y.Size(), y.Dist(), y.Data()), xs(xview.Size(), xview.Dist(), xview.Data());
+    KernelRoutes().gemv(ys, RowMajorStorage(A.View()), IsColMajor(A.View()), xs, alpha, beta);
+    return true;
+  }
+}
+
+// y = alpha*A*x + beta*y (beta is 0 or 1), called by the assignment operators of VectorView;
+// returns false for other than double products, which are then evaluated entry by entry
+template <typename T, typename TDIST, typename TA, typename TB>
+bool AssignMatVec(VectorView<T, TDIST> y, const ProdMatVecExpr<TA, TB> & prod, double alpha, double beta)
+{
+  if constexpr (std::is_same<T, double>::value && std::is_same<decltype(prod(0)), double>::value)
+    return AssignMatVec(y, prod.Left(), prod.Right(), alpha, beta);
+  else
+    return false;
+}
+
+// The inverse of M, for any entry type, ordering and allocator. Double matrices are inverted in place
+// through their LU factorization (see lu.h) if lu.h is included in any translation unit of the program,
+// which registers the route; otherwise, and for other entry types, by Gauss-Jordan elimination with
+// column operations.
+template <typename T, ORDERING ORD, typename ALLOC>
+Matrix<T, ORD, ALLOC> Inverse (Matrix<T, ORD, ALLOC> M) {
+  if constexpr (std::is_same<T, double>::value)
+    if (KernelRoutes().invert)
+    {
+      // the storage of a column-major M is M^T, whose inverse is the transposed inverse of M
+      KernelRoutes().invert(RowMajorStorage(M.View()));
+      return M;
+    }
+
+	/*
 		'augment'(Erweitern) the matrix (top) by the identity (=Einheitsmatrix) on the bottom
 		Turn the matrix on top into the identity by elementary column ops
 		The matrix on the bottom is the inverse (this was the identity matrix)
@@ -398,20 +661,19 @@ Matrix<T, ORD> Inverse (const Matrix<T, ORD> & M) {
 
   // implements pivot element algorithm with pivot element at (i, j)
   auto do_pivot = [](MatrixView<T, ORD> M, MatrixView<T, ORD> I, size_t i, size_t j, size_t n){
-    // copying out the pivot column(s)
-    auto pivcolM = M.Col(j);
-    auto pivcolI = I.Col(j);
-
     // turning the pivot column into the i-th column
     M.swapcols(i, j);
     I.swapcols(i, j);
 
+    auto pivcolM = M.Col(i);
+    auto pivcolI = I.Col(i);
+
     // storing the pivot element
     T pivelem = M(i, i);
 
     // generating the 1
-    M.Col(i) = (1/pivelem)*pivcolM;
-    I.Col(i) = (1/pivelem)*pivcolI;
+    pivcolM = (T(1)/pivelem)*pivcolM;
+    pivcolI = (T(1)/pivelem)*pivcolI;
 
     // generating the zeros
     for (size_t k = 0; k < n; k++){
@@ -419,14 +681,14 @@ Matrix<T, ORD> Inverse (const Matrix<T, ORD> & M) {
         auto colM = M.Col(k);
         auto colI = I.Col(k);
 
-        double M_i_k = M(i, k);
+        T M_i_k = M(i, k);
 
         colM = colM + (-M_i_k)*pivcolM;
         colI = colI + (-M_i_k)*pivcolI;
-      } 
+      }
     }
   };
-    
+
   //if the matrix isn't square: exit (error)
   if(M.width() != M.height()){
     throw std::invalid_argument("non-quadratic matrices cannot be inverted");
@@ -435,16 +697,11 @@ Matrix<T, ORD> Inverse (const Matrix<T, ORD> & M) {
   size_t n = M.height();
 
   // create a nxn identity matrix (I)
-  Matrix<T, ORD> I (n, n);
+  Matrix<T, ORD, ALLOC> I (n, n);
 
   for (size_t i=0; i < n; i++){
     for (size_t j=0; j < n; j++){
-      if (i == j){
-        I(i, j) = 1;
-      }
-      else{
-        I(i, j) = 0;
-      }
+      I(i, j) = (i == j) ? T(1) : T(0);
     }
   }
 
@@ -452,7 +709,7 @@ Matrix<T, ORD> Inverse (const Matrix<T, ORD> & M) {
   // i is the pivot row, j the pivot column
   for (size_t i=0; i < n; i++){
     for (size_t j=i; j < n; j++){
-      if (M(i, j) != 0){
+      if (M(i, j) != T(0)){
         // now, the pivot element has been found
         do_pivot(M, I, i, j, n); // the actual pivoting
         break;
@@ -465,26 +722,6 @@ Matrix<T, ORD> Inverse (const Matrix<T, ORD> & M) {
   return I;
 }
 
-
-// output stream operator (without variadic templates)
-template <typename T, ORDERING ORD>
-std::ostream & operator<< (std::ostream & ost, const MatrixView<T, ORD> & A){
-  if ((A.width() > 0) && (A.height() > 0)){
-    for (size_t i = 0; i < A.height(); i++){
-      ost << "(";
-      for (size_t j = 0; j < A.width(); j++){
-        // matrix elements are separated by tabs
-        ost << A(i, j) << "\t";
-      }
-      ost << ")" << std::endl;
-    }
-  }else{
-    ost << "empty matrix";
-  }
-  ost << std::endl;
-  return ost;
-}
-
 }  // namespace ASC_bla
 
 #endif
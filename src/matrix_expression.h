@@ -1,6 +1,8 @@
 #ifndef FILE_MATRIX_EXPRESSION_H
 #define FILE_MATRIX_EXPRESSION_H
 
+#include <type_traits>
+
 #include "matrix.h"
 #include "expression.h"
 
@@ -13,20 +15,20 @@ template <typename T>
 class MatrixExpr
 { 
  public:
-    auto Upcast() const { return static_cast<const T&> (*this); }
-    size_t height() const { return Upcast().height(); }
-    size_t width() const { return Upcast().width(); }
-    auto operator() (size_t i, size_t j) const { return Upcast()(i, j); }
+    constexpr const T & Upcast() const { return static_cast<const T&> (*this); }
+    constexpr size_t height() const { return Upcast().height(); }
+    constexpr size_t width() const { return Upcast().width(); }
+    constexpr auto operator() (size_t i, size_t j) const { return Upcast()(i, j); }
 };
 
 //Addition
 template <typename TA, typename TB>
 class SumMatrixExpr : public MatrixExpr<SumMatrixExpr<TA,TB>>
 {
-  TA A_;
-  TB B_;
+  expr_storage_t<TA> A_;
+  expr_storage_t<TB> B_;
 public:
-  SumMatrixExpr (TA A, TB B) : A_(A), B_(B) {
+  SumMatrixExpr (const TA & A, const TB & B) : A_(A), B_(B) {
     if (A.width() != B.width() || A.height() != B.height()){
       throw std::invalid_argument("matrix summands need to have the same shape");
     }
@@ -53,10 +55,10 @@ auto operator- (const MatrixExpr<TA> & A, const MatrixExpr<TB> & B)
 template <typename TA, typename TB>
 class ProdMatrixExpr : public MatrixExpr<ProdMatrixExpr<TA,TB> >
 {
-  TA A_;
-  TB B_;
+  expr_storage_t<TA> A_;
+  expr_storage_t<TB> B_;
 public:
-  ProdMatrixExpr (TA A, TB B) : A_(A), B_(B) {
+  ProdMatrixExpr (const TA & A, const TB & B) : A_(A), B_(B) {
     if (A.width() != B.height()){
       throw std::invalid_argument("matrix shapes are not compatible for multiplication");
     }
@@ -70,8 +72,19 @@ public:
   }
   size_t height() const { return A_.height(); }
   size_t width() const { return B_.width(); }     
+
+  // the factors, so that assignments can hand them to the kernels in fastmult.h
+  const TA & Left() const { return A_; }
+  const TB & Right() const { return B_; }
 };
 
+// true for ProdMatrixExpr, used to detect products when assigning
+template <typename T>
+struct is_prod_matrix_expr : std::false_type {};
+
+template <typename TA, typename TB>
+struct is_prod_matrix_expr<ProdMatrixExpr<TA, TB> > : std::true_type {};
+
 template <typename TA, typename TB>
 auto operator* (const MatrixExpr<TA> & A, const MatrixExpr<TB> & B)
 {
@@ -82,10 +95,10 @@ auto operator* (const MatrixExpr<TA> & A, const MatrixExpr<TB> & B)
 template <typename TA, typename TB>
 class ProdMatVecExpr : public VectorExpr<ProdMatVecExpr<TA,TB>>
 {
-  TA A_;
-  TB b_;
+  expr_storage_t<TA> A_;
+  expr_storage_t<TB> b_;
 public:
-  ProdMatVecExpr (TA A, TB b) : A_(A), b_(b) {
+  ProdMatVecExpr (const TA & A, const TB & b) : A_(A), b_(b) {
     if (A.width() != b.Size()){
       throw std::invalid_argument("matrix shape and vector length are not compatible for multiplication");
     }
@@ -99,8 +112,15 @@ public:
     return entry;
   }
   size_t Size() const { return A_.height(); }     
+
+  // the factors, so that assignments can hand them to the kernels
+  const TA & Left() const { return A_; }
+  const TB & Right() const { return b_; }
 };
 
+template <typename TA, typename TB>
+struct is_prod_matvec_expr<ProdMatVecExpr<TA, TB> > : std::true_type {};
+
 template <typename TA, typename TB>
 auto operator* (const MatrixExpr<TA> & A, const VectorExpr<TB> & b)
 {
@@ -112,16 +132,20 @@ template <typename TSCAL, typename TMAT>
 class ProdScalMatExpr : public MatrixExpr<ProdScalMatExpr<TSCAL, TMAT> >
 {
   TSCAL scal_;
-  TMAT A_;
+  expr_storage_t<TMAT> A_;
 
  public:
-  ProdScalMatExpr(TSCAL scal, TMAT A) : scal_(scal), A_(A) {;}
+  ProdScalMatExpr(TSCAL scal, const TMAT & A) : scal_(scal), A_(A) {;}
 
   auto operator() (size_t i, size_t j) const {
     return scal_ * A_(i, j);
   }
   size_t height() const { return A_.height(); }
   size_t width() const { return A_.width(); }
+
+  // the parts, so that products can take the scalar into the kernels
+  TSCAL Scal() const { return scal_; }
+  const TMAT & Mat() const { return A_; }
 };
 
 template <typename TA>
@@ -130,6 +154,19 @@ auto operator* (double scal, const MatrixExpr<TA> & A)
   return ProdScalMatExpr (scal, A.Upcast());
 }
 
+// true for ProdScalMatExpr
+template <typename T>
+struct is_scal_matrix_expr : std::false_type {};
+
+template <typename TSCAL, typename TMAT>
+struct is_scal_matrix_expr<ProdScalMatExpr<TSCAL, TMAT> > : std::true_type {};
+
+// true for everything that has dense double storage (MatrixView and Matrix)
+template <typename T>
+struct is_double_matrix_view
+  : std::integral_constant<bool, std::is_base_of<MatrixView<double, RowMajor>, T>::value
+                                 || std::is_base_of<MatrixView<double, ColMajor>, T>::value> {};
+
 
 template <typename T>
 std::ostream & operator<< (std::ostream & ost, const MatrixExpr<T> & A){
@@ -0,0 +1,242 @@
+#ifndef FILE_MATVEC_H
+#define FILE_MATVEC_H
+
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include "allocator.h"
+#include "expression.h"
+#include "fastmult.h"
+#include "matrix.h"
+#include "simd.h"
+#include "taskpool.h"
+
+
+namespace Neo_CLA{
+
+// Matrix-vector products y = alpha*A*x + beta*y of double views, the engine behind the assignment of A*x.
+// RowMajor A: four rows at a time, each with its own SIMD accumulators, over column blocks of A
+// whose part of x stays in the L2 cache. ColMajor A: y += A(:,k) x(k) for four columns at a time,
+// over row blocks whose part of y stays in the L1 cache. Tall matrices are split into row ranges for the task pool.
+
+constexpr size_t gemv_cols = 16384;  // columns per block of a row-major A: 128 KB of x
+constexpr size_t gemv_block = 1024;  // rows per block of a column-major A: 8 KB of y
+constexpr size_t gemv_rows = 8;      // granularity of the row ranges of the task pool
+
+// y(r*incy) += alpha * a(r*dist + k) x(k) summed over 0 <= k < n, for the R rows r of a
+template <int R>
+void matvecrows(const double * a, size_t dist, const double * x, size_t n, double alpha, double * y, size_t incy)
+{
+  constexpr int N = packet_size;
+  typedef SIMD<double, N> SIMDT;
+
+  // two accumulators per row, so 2*R FMAs are in flight
+  SIMDT acc0[R], acc1[R];
+  for (int r = 0; r < R; r++)
+    acc0[r] = acc1[r] = SIMDT(0.0);
+
+  size_t k = 0;
+  for ( ; k + 2*N <= n; k += 2*N)
+  {
+    SIMDT x0(x+k), x1(x+k+N);
+    for (int r = 0; r < R; r++)
+    {
+      acc0[r] = FMA(SIMDT(a + r*dist + k), x0, acc0[r]);
+      acc1[r] = FMA(SIMDT(a + r*dist + k+N), x1, acc1[r]);
+    }
+  }
+  for ( ; k + N <= n; k += N)
+  {
+    SIMDT x0(x+k);
+    for (int r = 0; r < R; r++)
+      acc0[r] = FMA(SIMDT(a + r*dist + k), x0, acc0[r]);
+  }
+
+  for (int r = 0; r < R; r++)
+  {
+    double sum = HSum(acc0[r] + acc1[r]);
+    for (size_t kk = k; kk < n; kk++)
+      sum += a[r*dist + kk] * x[kk];
+    y[r*incy] += alpha * sum;
+  }
+}
+
+// y(i) += alpha * sum a(k*dist + i) x(k*incx) over 0 <= k < n, for 0 <= i < h
+inline void matveccols(const double * a, size_t dist, size_t h, const double * x, size_t incx, size_t n,
+                       double alpha, double * y)
+{
+  constexpr int N = packet_size;
+  typedef SIMD<double, N> SIMDT;
+
+  size_t k = 0;
+  for ( ; k + 4 <= n; k += 4)
+  {
+    const double * a0 = a + k*dist;
+    const double * a1 = a0 + dist;
+    const double * a2 = a1 + dist;
+    const double * a3 = a2 + dist;
+    double s0 = alpha*x[k*incx], s1 = alpha*x[(k+1)*incx], s2 = alpha*x[(k+2)*incx], s3 = alpha*x[(k+3)*incx];
+    SIMDT p0(s0), p1(s1), p2(s2), p3(s3);
+
+    size_t i = 0;
+    for ( ; i + N <= h; i += N)
+    {
+      SIMDT yi(y+i);
+      yi = FMA(SIMDT(a0+i), p0, yi);
+      yi = FMA(SIMDT(a1+i), p1, yi);
+      yi = FMA(SIMDT(a2+i), p2, yi);
+      yi = FMA(SIMDT(a3+i), p3, yi);
+      yi.Store(y+i);
+    }
+    for ( ; i < h; i++)
+      y[i] += a0[i]*s0 + a1[i]*s1 + a2[i]*s2 + a3[i]*s3;
+  }
+  for ( ; k < n; k++)
+  {
+    const double * ak = a + k*dist;
+    double s = alpha*x[k*incx];
+    for (size_t i = 0; i < h; i++)
+      y[i] += ak[i]*s;
+  }
+}
+
+// [a, aend] and [b, bend] share memory
+inline bool rangesoverlap(const double * a, const double * aend, const double * b, const double * bend)
+{
+  return a <= bend && b <= aend;
+}
+
+// y = alpha*A*x + beta*y; beta = 0 overwrites y (even NaNs), like in BLAS.
+// Large products go to BLAS if lapack_interface.h has set up BlasRoutes().gemv.
+template <typename SY, ORDERING ORD, typename SX>
+void multgemv(VectorView<double, SY> y, MatrixView<double, ORD> A, VectorView<double, SX> x,
+              double alpha = 1.0, double beta = 0.0)
+{
+  if (A.width() != x.Size() || A.height() != y.Size())
+    throw std::invalid_argument("matrix shape and vector lengths are not compatible for multiplication");
+
+  size_t h = A.height(), w = A.width();
+  if (h == 0) return;
+
+  // the result would overwrite a factor: compute into a temporary first
+  const double * yend = y.Data() + (h-1)*y.Dist();
+  if ((w > 0 && rangesoverlap(y.Data(), yend, x.Data(), x.Data() + (w-1)*x.Dist()))
+      || (w > 0 && rangesoverlap(y.Data(), yend, A.Data(), &A(h-1, w-1))))
+  {
+    Vector<double, PoolAllocator<double> > tmp(h);
+    multgemv(tmp.View(), A, x, alpha, 0.0);
+    if (beta == 0.0)
+      y = tmp;
+    else
+    {
+      y *= beta;
+      y += tmp;
+    }
+    return;
+  }
+
+  const BlasDispatch & routes = BlasRoutes();
+  if (routes.gemv && w > 0 && h*w >= routes.gemv_threshold)
+  {
+    // the storage of a row-major A is the column-major A^T
+    if constexpr (ORD == ColMajor)
+      routes.gemv(false, h, w, alpha, A.Data(), std::max<size_t>(A.Dist(), 1),
+                  x.Data(), x.Dist(), beta, y.Data(), y.Dist());
+    else
+      routes.gemv(true, w, h, alpha, A.Data(), std::max<size_t>(A.Dist(), 1),
+                  x.Data(), x.Dist(), beta, y.Data(), y.Dist());
+    return;
+  }
+
+  if (beta == 0.0)
+    y = 0.0;
+  else if (beta != 1.0)
+    y *= beta;
+  if (w == 0) return;
+
+  constexpr bool xunit = std::is_same<SX, std::integral_constant<size_t, 1> >::value;
+  constexpr bool yunit = std::is_same<SY, std::integral_constant<size_t, 1> >::value;
+  size_t rowblocks = (h + gemv_rows - 1) / gemv_rows;
+
+  if constexpr (ORD == RowMajor)
+  {
+    // the rows are read in SIMD packets, so x needs unit stride
+    Vector<double, PoolAllocator<double> > xcopy(xunit ? 0 : w);
+    const double * px = x.Data();
+    if constexpr (!xunit)
+    {
+      xcopy = x;
+      px = xcopy.Data();
+    }
+
+    ParallelBlocks(rowblocks, gemv_rows*w, [&](size_t first, size_t next) {
+      size_t i0 = first*gemv_rows, i1 = std::min(h, next*gemv_rows);
+      for (size_t k = 0; k < w; k += gemv_cols)
+      {
+        size_t n = std::min(gemv_cols, w-k);
+        size_t i = i0;
+        for ( ; i + 4 <= i1; i += 4)
+          matvecrows<4>(&A(i, k), A.Dist(), px+k, n, alpha, &y(i), y.Dist());
+        switch (i1 - i)
+        {
+          case 3: matvecrows<3>(&A(i, k), A.Dist(), px+k, n, alpha, &y(i), y.Dist()); break;
+          case 2: matvecrows<2>(&A(i, k), A.Dist(), px+k, n, alpha, &y(i), y.Dist()); break;
+          case 1: matvecrows<1>(&A(i, k), A.Dist(), px+k, n, alpha, &y(i), y.Dist()); break;
+          default: break;
+        }
+      }
+    });
+  }
+  else
+  {
+    // y is updated in SIMD packets, so a strided y is collected in a temporary
+    Vector<double, PoolAllocator<double> > ycopy(yunit ? 0 : h);
+    double * py = y.Data();
+    if constexpr (!yunit)
+    {
+      ycopy = 0.0;
+      py = ycopy.Data();
+    }
+
+    ParallelBlocks(rowblocks, gemv_rows*w, [&](size_t first, size_t next) {
+      size_t i0 = first*gemv_rows, i1 = std::min(h, next*gemv_rows);
+      for (size_t i = i0; i < i1; i += gemv_block)
+      {
+        size_t m = std::min(gemv_block, i1-i);
+        matveccols(&A(i, 0), A.Dist(), m, x.Data(), x.Dist(), w, alpha, py+i);
+      }
+    });
+
+    if constexpr (!yunit)
+      y += ycopy;
+  }
+}
+
+// the route of the assignment operators of VectorView (see KernelDispatch in matrix.h):
+// y = alpha*op(A)*x + beta*y, unit strides are passed on to the kernels
+inline void gemvroute(VectorView<double, size_t> y, MatrixView<double, RowMajor> A, bool transa,
+                      VectorView<double, size_t> x, double alpha, double beta)
+{
+  typedef std::integral_constant<size_t, 1> UNIT;
+  auto mult = [&](auto yv, auto xv) {
+    if (transa)
+      multgemv(yv, A.transposed(), xv, alpha, beta);
+    else
+      multgemv(yv, A, xv, alpha, beta);
+  };
+
+  bool yunit = y.Dist() == 1, xunit = x.Dist() == 1;
+  if (yunit && xunit) mult(VectorView<double, UNIT>(y.Size(), y.Data()), VectorView<double, UNIT>(x.Size(), x.Data()));
+  else if (yunit) mult(VectorView<double, UNIT>(y.Size(), y.Data()), x);
+  else if (xunit) mult(y, VectorView<double, UNIT>(x.Size(), x.Data()));
+  else mult(y, x);
+}
+
+inline const bool gemv_route_registered = [] {
+  KernelRoutes().gemv = gemvroute;
+  return true;
+}();
+
+} // namespace
+#endif
@@ -0,0 +1,233 @@
+#ifndef FILE_MICROKERNELS_H
+#define FILE_MICROKERNELS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "expression.h"
+#include "gemmprofile.h"
+
+
+namespace Neo_CLA{
+
+// The micro-kernels compute C += A*B for one MRxNR block of C from packed panels of A and B.
+// They are written once with GCC vector extensions and compiled several times for different
+// instruction sets (via target attributes), so that one binary runs optimally on every x86 CPU:
+// the best kernel supported by the machine is chosen at runtime.
+
+// vector types of VW doubles, mapped to xmm, ymm and zmm registers
+typedef double vdouble2 __attribute__((vector_size(2*sizeof(double))));
+typedef double vdouble4 __attribute__((vector_size(4*sizeof(double))));
+typedef double vdouble8 __attribute__((vector_size(8*sizeof(double))));
+
+template <int VW> struct vdouble;
+template <> struct vdouble<2> { typedef vdouble2 type; };
+template <> struct vdouble<4> { typedef vdouble4 type; };
+template <> struct vdouble<8> { typedef vdouble8 type; };
+
+
+// The template and the generic kernel are compiled for the x86-64 baseline (SSE2) even if the build
+// enables AVX (ARCH_FLAGS, NATIVE_ARCH): the generic kernel has to run on every CPU, and the other
+// instances inline the template into functions with more instruction sets. GCC only, since Clang has no
+// target pragma; the generic kernel then has the instruction set of the build.
+#if defined(__GNUC__) && !defined(__clang__) && (defined(__x86_64__) || defined(__i386__))
+#define NEO_CLA_BASELINE_TARGET
+#pragma GCC push_options
+#pragma GCC target ("no-avx")
+#endif
+
+// C += A*B for an MR x (NV*VW) block starting at C (row distance distc).
+// Ap is a panel of kc columns of height MR, Bp a panel of kc rows of width NV*VW
+// (see packA, packB in fastmult.h), only h rows and w columns of C are written back.
+// The accumulators are kept in registers, so NV*MR must not exceed the number of vector registers.
+template <int MR, int NV, int VW>
+inline __attribute__((always_inline))
+void microkernel(size_t kc, const double * Ap, const double * Bp, double * C, size_t distc, size_t h, size_t w)
+{
+  typedef typename vdouble<VW>::type vt;
+  constexpr int NR = NV*VW;
+
+  vt acc[MR][NV];
+#pragma GCC unroll 16
+  for (int r = 0; r < MR; r++)
+#pragma GCC unroll 16
+    for (int v = 0; v < NV; v++)
+      acc[r][v] = vt{};
+
+  for (size_t p = 0; p < kc; p++, Ap += MR, Bp += NR)
+  {
+    vt b[NV];
+#pragma GCC unroll 16
+    for (int v = 0; v < NV; v++)
+      std::memcpy(&b[v], Bp + v*VW, sizeof(vt));
+
+#pragma GCC unroll 16
+    for (int r = 0; r < MR; r++)
+    {
+      vt a = vt{} + Ap[r]; // broadcast
+#pragma GCC unroll 16
+      for (int v = 0; v < NV; v++)
+        acc[r][v] += a * b[v];
+    }
+  }
+
+  if (h == MR && w == NR)
+  {
+#pragma GCC unroll 16
+    for (int r = 0; r < MR; r++)
+#pragma GCC unroll 16
+      for (int v = 0; v < NV; v++)
+      {
+        vt c;
+        std::memcpy(&c, C + r*distc + v*VW, sizeof(vt));
+        c += acc[r][v];
+        std::memcpy(C + r*distc + v*VW, &c, sizeof(vt));
+      }
+  }
+  else
+  {
+    // edge of C: write back through a buffer
+    alignas (64) double tmp[MR*NR];
+#pragma GCC unroll 16
+    for (int r = 0; r < MR; r++)
+#pragma GCC unroll 16
+      for (int v = 0; v < NV; v++)
+        std::memcpy(tmp + r*NR + v*VW, &acc[r][v], sizeof(vt));
+
+    for (size_t r = 0; r < h; r++)
+      for (size_t c = 0; c < w; c++)
+        C[r*distc + c] += tmp[r*NR + c];
+  }
+}
+
+
+// the instances of microkernel, one function per instruction set and shape
+
+#define NEO_CLA_MICROKERNEL_ARGS size_t kc, const double * Ap, const double * Bp, double * C, size_t distc, size_t h, size_t w
+
+// generic fallback, SSE2 on x86 (16 registers of 2 doubles)
+inline void microkernel_generic_4x4(NEO_CLA_MICROKERNEL_ARGS)
+{ microkernel<4, 2, 2>(kc, Ap, Bp, C, distc, h, w); }
+
+#ifdef NEO_CLA_BASELINE_TARGET
+#pragma GCC pop_options
+#undef NEO_CLA_BASELINE_TARGET
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// AVX2 (16 registers of 4 doubles)
+__attribute__((target("avx2,fma")))
+inline void microkernel_avx2_4x12(NEO_CLA_MICROKERNEL_ARGS)
+{ microkernel<4, 3, 4>(kc, Ap, Bp, C, distc, h, w); }
+
+__attribute__((target("avx2,fma")))
+inline void microkernel_avx2_6x8(NEO_CLA_MICROKERNEL_ARGS)
+{ microkernel<6, 2, 4>(kc, Ap, Bp, C, distc, h, w); }
+
+// AVX-512 (32 registers of 8 doubles)
+__attribute__((target("avx512f")))
+inline void microkernel_avx512_8x24(NEO_CLA_MICROKERNEL_ARGS)
+{ microkernel<8, 3, 8>(kc, Ap, Bp, C, distc, h, w); }
+
+__attribute__((target("avx512f")))
+inline void microkernel_avx512_14x16(NEO_CLA_MICROKERNEL_ARGS)
+{ microkernel<14, 2, 8>(kc, Ap, Bp, C, distc, h, w); }
+
+#endif
+
+#undef NEO_CLA_MICROKERNEL_ARGS
+
+
+// a micro-kernel together with its block shape
+struct MicroKernel
+{
+  const char * name;
+  size_t mr; // rows of the block of C (height of the panels of A)
+  size_t nr; // columns of the block of C (width of the panels of B)
+  void (*func) (size_t kc, const double * Ap, const double * Bp, double * C, size_t distc, size_t h, size_t w);
+};
+
+// all kernels the CPU we are running on supports, the preferred one first
+inline const std::vector<MicroKernel> & AvailableMicroKernels()
+{
+  static const std::vector<MicroKernel> kernels = [](){
+    std::vector<MicroKernel> list;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+      list.push_back({"avx512_8x24", 8, 24, microkernel_avx512_8x24});
+      list.push_back({"avx512_14x16", 14, 16, microkernel_avx512_14x16});
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+      list.push_back({"avx2_4x12", 4, 12, microkernel_avx2_4x12});
+      list.push_back({"avx2_6x8", 6, 8, microkernel_avx2_6x8});
+    }
+#endif
+    list.push_back({"generic_4x4", 4, 4, microkernel_generic_4x4});
+    return list;
+  }();
+  return kernels;
+}
+
+// the kernel used by multpacked and multparallel: the one of the profile given by NEO_CLA_GEMM_PROFILE
+// (if it is available on this CPU), else the preferred one. It points into AvailableMicroKernels(),
+// so SetMicroKernel can swap it while products run; each product reads it once and keeps its kernel.
+inline std::atomic<const MicroKernel *> & ActiveMicroKernelPtr()
+{
+  static std::atomic<const MicroKernel *> kernel = [](){
+    if (EnvironmentGemmProfile())
+      for (const MicroKernel & k : AvailableMicroKernels())
+        if (EnvironmentGemmProfile()->kernel == k.name) return &k;
+    return &AvailableMicroKernels()[0];
+  }();
+  return kernel;
+}
+
+inline const MicroKernel & ActiveMicroKernel()
+{
+  return *ActiveMicroKernelPtr().load(std::memory_order_acquire);
+}
+
+// selects a kernel by name, e.g. for benchmarks or after tuning
+inline void SetMicroKernel(const std::string & name)
+{
+  for (const MicroKernel & kernel : AvailableMicroKernels())
+  {
+    if (name == kernel.name)
+    {
+      ActiveMicroKernelPtr().store(&kernel, std::memory_order_release);
+      return;
+    }
+  }
+  throw std::invalid_argument("micro-kernel " + name + " is not available on this CPU");
+}
+
+// the BLAS crossovers measured by tune_fastmult, if the profile has them
+inline void SetBlasThresholds(const GemmProfile & profile)
+{
+  if (profile.dot_threshold) BlasRoutes().dot_threshold = *profile.dot_threshold;
+  if (profile.gemv_threshold) BlasRoutes().gemv_threshold = *profile.gemv_threshold;
+}
+
+// uses the kernel, the blocking and the BLAS crossovers of a profile written by tune_fastmult,
+// e.g. from DefaultGemmProfilePath()
+inline void LoadGemmProfile(const std::string & path)
+{
+  std::optional<GemmProfile> profile = ReadGemmProfile(path);
+  if (!profile)
+    throw std::runtime_error("cannot read GEMM profile " + path);
+  SetMicroKernel(profile->kernel);
+  SetGemmDefaults(profile->blocks);
+  SetBlasThresholds(*profile);
+}
+
+} // namespace
+#endif
@@ -0,0 +1,353 @@
+#ifndef FILE_SYMMETRIC_H
+#define FILE_SYMMETRIC_H
+
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "allocator.h"
+#include "arena.h"
+#include "expression.h"
+#include "fastmult.h"
+#include "gemmprofile.h"
+#include "matrix.h"
+#include "matvec.h"
+#include "microkernels.h"
+#include "simd.h"
+#include "taskpool.h"
+
+
+namespace Neo_CLA{
+
+// A symmetric matrix is stored in one triangle of a square MatrixView; the other triangle is not referenced,
+// so it may hold something else. The rank-k updates compute only the tiles of one triangle with the packed
+// kernels of fastmult.h, which halves the flops of Gram matrices A*A^T and normal equations A^T*A.
+
+
+// entries (i,j) of the triangle tri of a square matrix
+inline bool intriangle(size_t i, size_t j, TRIANGLE tri)
+{
+  return (tri == Lower) ? j <= i : j >= i;
+}
+
+// copies the triangle tri of C to the other one, so C holds the full symmetric matrix
+template <ORDERING ORD>
+void mirror(MatrixView<double, ORD> C, TRIANGLE tri)
+{
+  size_t n = C.height();
+  ParallelBlocks(n, n, [&](size_t first, size_t next) {
+    for (size_t i = first; i < next; i++)
+      for (size_t j = 0; j < i; j++)
+        if (tri == Lower)
+          C(j, i) = C(i, j);
+        else
+          C(i, j) = C(j, i);
+  });
+}
+
+
+// symmetric matrix given by the triangle tri of a square MatrixView
+template <typename T = double, ORDERING ORD = RowMajor>
+class SymmetricView : public MatrixExpr<SymmetricView<T, ORD> >
+{
+  MatrixView<T, ORD> A_;
+  TRIANGLE tri_;
+
+ public:
+  SymmetricView (MatrixView<T, ORD> A, TRIANGLE tri = Lower)
+    : A_(A), tri_(tri)
+  {
+    if (A.height() != A.width())
+      throw std::invalid_argument("a symmetric matrix needs to be square");
+  }
+
+  // reads the stored triangle only
+  T operator() (size_t i, size_t j) const { return intriangle(i, j, tri_) ? A_(i, j) : A_(j, i); }
+
+  size_t height() const { return A_.height(); }
+  size_t width() const { return A_.width(); }
+
+  TRIANGLE Triangle() const { return tri_; }
+  MatrixView<T, ORD> Storage() const { return A_; }
+
+  // fills the other triangle of the storage, e.g. before it is handed to dense code
+  void Mirror() { mirror(A_, tri_); }
+};
+
+
+// the square tiles of the triangle tri of C that multsyrk hands out to the task pool
+inline std::vector<std::pair<size_t, size_t> > triangletiles(size_t n, size_t ts, TRIANGLE tri)
+{
+  size_t nt = (n + ts - 1) / ts;
+  std::vector<std::pair<size_t, size_t> > tiles;
+  for (size_t I = 0; I < nt; I++)
+    for (size_t J = 0; J < nt; J++)
+      if (intriangle(I, J, tri))
+        tiles.emplace_back(I, J);
+  return tiles;
+}
+
+// C += alpha*A*B^T (+ alpha*B*A^T if twosided is set) on the triangle tri of a row-major C.
+// For every block of kc columns, A and B are packed once for the whole matrix, in the panels of both sides
+// of the micro-kernel; the square tiles of the triangle then read their panels from these shared buffers,
+// distributed over the task pool like the tiles of multparallel. The tiles on the diagonal are computed
+// in a buffer of the thread, so nothing outside the triangle is written.
+template <ORDERING ORDA, ORDERING ORDB>
+void multtriangle(MatrixView<double, RowMajor> C, MatrixView<double, ORDA> A, MatrixView<double, ORDB> B,
+                  double alpha, bool twosided, TRIANGLE tri)
+{
+  const MicroKernel & kernel = ActiveMicroKernel();
+  size_t n = C.height();
+  size_t k = A.width();
+  GemmBlocking defaults = GemmDefaults();
+  size_t kc = std::max(size_t(1), defaults.kc);
+  // tiles start at whole panels of both sides
+  size_t ts = roundup(std::max(size_t(1), defaults.mc), std::lcm(kernel.mr, kernel.nr));
+
+  auto tiles = triangletiles(n, ts, tri);
+  size_t panelsA = (n + kernel.mr - 1) / kernel.mr;
+  size_t panelsB = (n + kernel.nr - 1) / kernel.nr;
+  size_t sizeA = roundup(panelsA*kernel.mr*kc, 8); // keep the 64-byte alignment of the others
+  size_t sizeB = roundup(panelsB*kernel.nr*kc, 8);
+
+  size_t workers = std::min(NumThreads(), tiles.size());
+  size_t sizeD = roundup(ts*ts, 8);
+
+  // the products A*B^T and (if twosided) B*A^T, left factors scaled by alpha, and behind them one
+  // diagonal tile per thread: all in one lease, so the kc blocks allocate nothing
+  int products = twosided ? 2 : 1;
+  ArenaLease mem(products * (sizeA + sizeB) + workers * sizeD);
+  double * left[2] = { mem.Data(), mem.Data() + sizeA + sizeB };
+  double * right[2] = { left[0] + sizeA, left[1] + sizeA };
+  double * diagmem = mem.Data() + products * (sizeA + sizeB);
+
+  for (size_t k1 = 0; k1 < k; k1 += kc)
+  {
+    size_t kb = std::min(kc, k-k1);
+
+    // panel p of a left factor starts at p*mr*kb, of a right factor at p*nr*kb
+    ParallelBlocks(panelsA, kernel.mr*kb, [&](size_t first, size_t next) {
+      size_t i1 = first*kernel.mr, i2 = std::min(n, next*kernel.mr);
+      packA(A.Rows(i1, i2-i1).Cols(k1, kb), left[0] + i1*kb, kernel.mr, alpha);
+      if (twosided)
+        packA(B.Rows(i1, i2-i1).Cols(k1, kb), left[1] + i1*kb, kernel.mr, alpha);
+    });
+    ParallelBlocks(panelsB, kernel.nr*kb, [&](size_t first, size_t next) {
+      size_t j1 = first*kernel.nr, j2 = std::min(n, next*kernel.nr);
+      packB(B.Rows(j1, j2-j1).Cols(k1, kb).transposed(), right[0] + j1*kb, kernel.nr);
+      if (twosided)
+        packB(A.Rows(j1, j2-j1).Cols(k1, kb).transposed(), right[1] + j1*kb, kernel.nr);
+    });
+
+    std::atomic<size_t> nexttile{0};
+    RunParallel(workers, [&](int nr, int){
+      double * diagtile = diagmem + nr*sizeD; // private to this thread
+
+      for (size_t t = nexttile++; t < tiles.size(); t = nexttile++)
+      {
+        size_t i1 = tiles[t].first * ts, i2 = std::min(n, i1+ts);
+        size_t j1 = tiles[t].second * ts, j2 = std::min(n, j1+ts);
+        bool diag = i1 == j1;
+
+        MatrixView<double, RowMajor> target = diag ? MatrixView<double, RowMajor>(i2-i1, j2-j1, ts, diagtile)
+                                                   : C.Rows(i1, i2-i1).Cols(j1, j2-j1);
+        if (diag) target = 0.0;
+
+        for (int p = 0; p < products; p++)
+          multpanels(target, left[p] + i1*kb, right[p] + j1*kb, kb, kernel);
+
+        if (diag)
+          for (size_t i = 0; i < i2-i1; i++)
+            for (size_t j = 0; j < j2-j1; j++)
+              if (intriangle(i, j, tri))
+                C(i1+i, j1+j) += target(i, j);
+      }
+    });
+  }
+}
+
+// C = alpha*A*B^T + beta*C (or alpha*(A*B^T + B*A^T) + beta*C if twosided is set) on the triangle tri,
+// for any orderings; beta = 0 overwrites the triangle (even NaNs), like in BLAS
+template <ORDERING ORDC, ORDERING ORDA, ORDERING ORDB>
+void multsymmetric(MatrixView<double, ORDC> C, MatrixView<double, ORDA> A, MatrixView<double, ORDB> B,
+                   double alpha, double beta, bool twosided, TRIANGLE tri, bool mirrored)
+{
+  if (C.height() != C.width() || A.height() != C.height() || B.height() != A.height() || B.width() != A.width())
+    throw std::invalid_argument("matrix shapes are not compatible for a symmetric rank-k update");
+  size_t n = C.height();
+  if (n == 0) return;
+
+  // the result would overwrite a factor: compute into a temporary first
+  if (overlaps(C, A) || overlaps(C, B))
+  {
+    Matrix<double, ORDC> tmp(n, n);
+    multsymmetric(tmp.View(), A, B, alpha, 0.0, twosided, tri, false);
+    ParallelBlocks(n, n, [&](size_t first, size_t next) {
+      for (size_t i = first; i < next; i++)
+        for (size_t j = 0; j < n; j++)
+          if (intriangle(i, j, tri))
+            C(i, j) = (beta == 0.0) ? tmp(i, j) : beta*C(i, j) + tmp(i, j);
+    });
+    if (mirrored) mirror(C, tri);
+    return;
+  }
+
+  if (beta != 1.0)
+    ParallelBlocks(n, n, [&](size_t first, size_t next) {
+      for (size_t i = first; i < next; i++)
+        for (size_t j = 0; j < n; j++)
+          if (intriangle(i, j, tri))
+            C(i, j) = (beta == 0.0) ? 0.0 : beta*C(i, j);
+    });
+
+  // the triangle tri of C is the other triangle of the row-major C^T, which has the same value
+  if constexpr (ORDC == RowMajor)
+    multtriangle(C, A, B, alpha, twosided, tri);
+  else
+    multtriangle(C.transposed(), A, B, alpha, twosided, tri == Lower ? Upper : Lower);
+
+  if (mirrored) mirror(C, tri);
+}
+
+// C = alpha*A*A^T + beta*C on the triangle tri of C (BLAS dsyrk); with mirrored set,
+// the other triangle is filled as well. Use A.transposed() for A^T*A.
+template <ORDERING ORDC, ORDERING ORDA>
+void multsyrk(MatrixView<double, ORDC> C, MatrixView<double, ORDA> A, double alpha = 1.0, double beta = 0.0,
+              TRIANGLE tri = Lower, bool mirrored = false)
+{
+  multsymmetric(C, A, A, alpha, beta, false, tri, mirrored);
+}
+
+// C = alpha*(A*B^T + B*A^T) + beta*C on the triangle tri of C (BLAS dsyr2k)
+template <ORDERING ORDC, ORDERING ORDA, ORDERING ORDB>
+void multsyr2k(MatrixView<double, ORDC> C, MatrixView<double, ORDA> A, MatrixView<double, ORDB> B,
+               double alpha = 1.0, double beta = 0.0, TRIANGLE tri = Lower, bool mirrored = false)
+{
+  multsymmetric(C, A, B, alpha, beta, true, tri, mirrored);
+}
+
+// the same into the stored triangle of a SymmetricView
+template <ORDERING ORDC, ORDERING ORDA>
+void multsyrk(SymmetricView<double, ORDC> C, MatrixView<double, ORDA> A, double alpha = 1.0, double beta = 0.0)
+{
+  multsymmetric(C.Storage(), A, A, alpha, beta, false, C.Triangle(), false);
+}
+
+template <ORDERING ORDC, ORDERING ORDA, ORDERING ORDB>
+void multsyr2k(SymmetricView<double, ORDC> C, MatrixView<double, ORDA> A, MatrixView<double, ORDB> B,
+               double alpha = 1.0, double beta = 0.0)
+{
+  multsymmetric(C.Storage(), A, B, alpha, beta, true, C.Triangle(), false);
+}
+
+
+// y(0...n-1) += alpha*a(i) x(0...n-1) and return the sum of a(k) x(k): one pass over a row of a triangle
+// gives one entry of S*x and the contribution of the mirrored column to the other entries
+inline double symrow(const double * a, const double * x, size_t n, double ax, double * y)
+{
+  constexpr int N = packet_size;
+  typedef SIMD<double, N> SIMDT;
+
+  SIMDT acc(0.0), pax(ax);
+  size_t k = 0;
+  for ( ; k + N <= n; k += N)
+  {
+    SIMDT ak(a+k);
+    acc = FMA(ak, SIMDT(x+k), acc);
+    FMA(ak, pax, SIMDT(y+k)).Store(y+k);
+  }
+  double sum = HSum(acc);
+  for ( ; k < n; k++)
+  {
+    sum += a[k]*x[k];
+    y[k] += a[k]*ax;
+  }
+  return sum;
+}
+
+// y = alpha*S*x + beta*y, reading every entry of the stored triangle once
+template <typename SY, ORDERING ORD, typename SX>
+void multsymv(VectorView<double, SY> y, SymmetricView<double, ORD> S, VectorView<double, SX> x,
+              double alpha = 1.0, double beta = 0.0)
+{
+  // the column-major triangle is the other triangle of the row-major transpose
+  if constexpr (ORD == ColMajor)
+  {
+    multsymv(y, SymmetricView<double, RowMajor>(S.Storage().transposed(), S.Triangle() == Lower ? Upper : Lower),
+             x, alpha, beta);
+  }
+  else
+  {
+    size_t n = S.height();
+    if (x.Size() != n || y.Size() != n)
+      throw std::invalid_argument("matrix shape and vector lengths are not compatible for multiplication");
+    if (n == 0) return;
+
+    // unit-stride copies, so both x and y are accessed in SIMD packets; y may also overlap S or x
+    Vector<double, PoolAllocator<double> > xc(n), yc(n);
+    xc = x;
+    yc = 0.0;
+
+    MatrixView<double, RowMajor> A = S.Storage();
+    for (size_t i = 0; i < n; i++)
+    {
+      double ax = alpha*xc(i);
+      if (S.Triangle() == Lower)
+        yc(i) += alpha*symrow(&A(i, 0), xc.Data(), i, ax, yc.Data()) + ax*A(i, i);
+      else
+        yc(i) += alpha*symrow(&A(i, i) + 1, xc.Data() + i+1, n-i-1, ax, yc.Data() + i+1) + ax*A(i, i);
+    }
+
+    if (beta == 0.0)
+      y = yc;
+    else
+    {
+      y *= beta;
+      y += yc;
+    }
+  }
+}
+
+// assignments of S*x go to multsymv
+template <typename SY, ORDERING ORD, typename TB>
+bool AssignMatVec(VectorView<double, SY> y, const SymmetricView<double, ORD> & S, const TB & x, double alpha, double beta)
+{
+  if constexpr (!is_double_vector_view<TB>::value)
+  {
+    Vector<double, PoolAllocator<double> > xeval(x);
+    multsymv(y, S, xeval.View(), alpha, beta);
+  }
+  else
+    multsymv(y, S, x.View(), alpha, beta);
+  return true;
+}
+
+// the route of the assignment operators of MatrixView (see KernelDispatch in matrix.h):
+// C = alpha*op(A)*op(B) + beta*C for row-major storage, registered here next to the rank-k update
+inline void gemmroute(MatrixView<double, RowMajor> C, MatrixView<double, RowMajor> A, bool transa,
+                      MatrixView<double, RowMajor> B, bool transb, double alpha, double beta)
+{
+  auto mult = [&](auto opA, auto opB) {
+    // A*A^T and A^T*A: one triangle is computed and mirrored
+    if (beta == 0.0 && istransposed(opA, opB))
+      multsyrk(C, opA, alpha, 0.0, Lower, true);
+    else
+      multgemm(C, opA, opB, alpha, beta);
+  };
+
+  if (transa && transb) mult(A.transposed(), B.transposed());
+  else if (transa) mult(A.transposed(), B);
+  else if (transb) mult(A, B.transposed());
+  else mult(A, B);
+}
+
+inline const bool gemm_route_registered = [] {
+  KernelRoutes().gemm = gemmroute;
+  return true;
+}();
+
+} // namespace
+#endif
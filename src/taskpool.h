@@ -0,0 +1,144 @@
+#ifndef FILE_TASKPOOL_H
+#define FILE_TASKPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "arena.h"
+#include "taskmanager.cc"
+
+
+namespace Neo_CLA{
+
+using namespace Neo_HPC;
+
+// One process-wide pool of worker threads, shared by all parallel kernels.
+// Starting and stopping threads is expensive, so the workers are started once
+// (explicitly or by the first RunParallel) and kept alive until StopTaskPool() or program exit.
+// The pool is only resized or stopped while no RunParallel is in flight.
+class TaskPool
+{
+  std::mutex poolmutex_;
+  std::atomic<size_t> numthreads_; // threads doing work, including the calling thread
+  bool running_ = false;           // guarded by poolmutex_
+  size_t jobs_ = 0;                // RunParallel calls in flight, guarded by poolmutex_
+
+  TaskPool() : numthreads_(HardwareThreads()) { }
+
+  static size_t HardwareThreads() { return std::max(1u, std::thread::hardware_concurrency()); }
+
+  // throws while kernels are running on the workers
+  void CheckIdle(const char * what) const
+  {
+    if (jobs_ > 0)
+      throw std::logic_error(std::string(what) + ": parallel jobs of the task pool are running");
+  }
+
+ public:
+  TaskPool(const TaskPool &) = delete;
+  TaskPool & operator= (const TaskPool &) = delete;
+
+  // the pool is stopped when the program ends
+  // (the arena of the main thread is already destroyed at this point, so don't Release it)
+  ~TaskPool()
+  {
+    std::lock_guard<std::mutex> lock(poolmutex_);
+    if (running_) StopWorkers();
+  }
+
+  static TaskPool & Instance()
+  {
+    static TaskPool pool;
+    return pool;
+  }
+
+  // num_threads = 0 keeps the number set before (all hardware threads by default)
+  void Start(size_t num_threads = 0)
+  {
+    std::lock_guard<std::mutex> lock(poolmutex_);
+    if (running_) return;
+
+    if (num_threads > 0) numthreads_ = num_threads;
+    // the calling thread works as well, so one worker less
+    StartWorkers(numthreads_ - 1);
+    running_ = true;
+  }
+
+  void Stop()
+  {
+    std::lock_guard<std::mutex> lock(poolmutex_);
+    if (!running_) return;
+    CheckIdle("StopTaskPool");
+
+    StopWorkers(); // the arenas of the workers go with their threads
+    PackingArena::Local().Release();
+    running_ = false;
+  }
+
+  // restarts running workers with a different number of threads (0: all hardware threads),
+  // in one step under the lock, so no RunParallel can start in between
+  void SetNumThreads(size_t num_threads)
+  {
+    std::lock_guard<std::mutex> lock(poolmutex_);
+    CheckIdle("SetNumThreads");
+
+    if (num_threads == 0) num_threads = HardwareThreads();
+    if (running_ && num_threads != numthreads_)
+    {
+      StopWorkers();
+      StartWorkers(num_threads - 1);
+    }
+    numthreads_ = num_threads;
+  }
+
+  // the number of threads the kernels split their work into; doesn't start the pool
+  size_t NumThreads() const { return numthreads_.load(std::memory_order_relaxed); }
+
+  // runs func(nr, size) for nr < num on the workers and the calling thread, starting the pool if necessary
+  template <typename FUNC>
+  void RunParallel(int num, FUNC && func)
+  {
+    {
+      std::lock_guard<std::mutex> lock(poolmutex_);
+      if (!running_)
+      {
+        StartWorkers(numthreads_ - 1);
+        running_ = true;
+      }
+      jobs_++;
+    }
+
+    struct JobDone
+    {
+      TaskPool & pool;
+      ~JobDone() { std::lock_guard<std::mutex> lock(pool.poolmutex_); pool.jobs_--; }
+    } done { *this };
+
+    Neo_HPC::RunParallel(num, std::forward<FUNC>(func));
+  }
+
+  bool Running()
+  {
+    std::lock_guard<std::mutex> lock(poolmutex_);
+    return running_;
+  }
+};
+
+
+// shortcuts to the global pool
+
+inline void StartTaskPool(size_t num_threads = 0) { TaskPool::Instance().Start(num_threads); }
+inline void StopTaskPool() { TaskPool::Instance().Stop(); }
+inline void SetNumThreads(size_t num_threads) { TaskPool::Instance().SetNumThreads(num_threads); }
+inline size_t NumThreads() { return TaskPool::Instance().NumThreads(); }
+
+// the kernels of this library go through the pool, which counts the jobs in flight
+template <typename FUNC>
+void RunParallel(int num, FUNC && func) { TaskPool::Instance().RunParallel(num, std::forward<FUNC>(func)); }
+
+} // namespace
+#endif
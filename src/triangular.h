@@ -0,0 +1,280 @@
+#ifndef FILE_TRIANGULAR_H
+#define FILE_TRIANGULAR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+
+#include "allocator.h"
+#include "arena.h"
+#include "expression.h"
+#include "fastmult.h"
+#include "matrix.h"
+#include "simd.h"
+#include "taskpool.h"
+
+
+namespace Neo_CLA{
+
+// Triangular matrices stored in one triangle of a square MatrixView (e.g. the factors of an LU
+// factorization, which share one matrix), and the triangular solve B := T^{-1} B (BLAS dtrsm) and
+// product B := T B (dtrmm) with many right-hand sides. Both are formulated recursively like the
+// routines of lu.h, so almost all flops are spent in matrix products on large blocks; only blocks of
+// at most trsm_base rows are handled by a SIMD kernel, over column chunks of B on the task pool.
+
+// rows of the triangles handled by trianglerows, which gets a share of about trsm_base/n of the flops
+// and is slower than the GEMM micro-kernel, so the base case is kept small
+constexpr size_t trsm_base = 16;
+constexpr size_t trsm_cols = 256; // columns of B per task of the task pool
+
+
+// the block of height h and width w starting at (i, j)
+template <ORDERING ORD>
+MatrixView<double, ORD> Block(MatrixView<double, ORD> A, size_t i, size_t j, size_t h, size_t w)
+{
+  return A.Rows(i, h).Cols(j, w);
+}
+
+// C += alpha*A*B for blocks which don't share entries (e.g. of one matrix), so no temporary is needed
+template <ORDERING ORDC, ORDERING ORDA, ORDERING ORDB>
+void MultAddBlocks(MatrixView<double, ORDC> C, MatrixView<double, ORDA> A, MatrixView<double, ORDB> B, double alpha)
+{
+  if (C.height() == 0 || C.width() == 0 || A.width() == 0) return;
+
+  if constexpr (ORDC == RowMajor)
+    multauto(C, A, B, alpha);
+  else
+    multauto(C.transposed(), B.transposed(), A.transposed(), alpha);
+}
+
+
+// triangular matrix given by the triangle tri of a square MatrixView, with ones on the diagonal if unit is set;
+// the other triangle (and the diagonal of a unit triangular matrix) is not referenced
+template <typename T, ORDERING ORD>
+class TriangularView : public MatrixExpr<TriangularView<T, ORD> >
+{
+  MatrixView<T, ORD> A_;
+  TRIANGLE tri_;
+  bool unit_;
+
+ public:
+  TriangularView (MatrixView<T, ORD> A, TRIANGLE tri = Lower, bool unit = false)
+    : A_(A), tri_(tri), unit_(unit)
+  {
+    if (A.height() != A.width())
+      throw std::invalid_argument("a triangular matrix needs to be square");
+  }
+
+  T operator() (size_t i, size_t j) const
+  {
+    if (i == j) return unit_ ? T(1) : A_(i, i);
+    return ((tri_ == Lower) ? j < i : j > i) ? A_(i, j) : T(0);
+  }
+
+  size_t height() const { return A_.height(); }
+  size_t width() const { return A_.width(); }
+
+  TRIANGLE Triangle() const { return tri_; }
+  bool Unit() const { return unit_; }
+  MatrixView<T, ORD> Storage() const { return A_; }
+
+  // the same storage read as the transposed matrix, which has the other triangle
+  auto transposed() const
+  {
+    constexpr ORDERING ORDT = (ORD == RowMajor) ? ColMajor : RowMajor;
+    return TriangularView<T, ORDT>(A_.transposed(), tri_ == Lower ? Upper : Lower, unit_);
+  }
+};
+
+
+// b_i := l(i,i) b_i + sum_{p<i} l(i,p) b_p for the k rows b_i = b + i*ld (0 <= j < m) of a block with unit
+// column stride, l row-major k x k. Row by row in increasing order of i if forward is set (b_p are the new
+// rows, as for a forward substitution), otherwise in decreasing order (b_p are the old rows, as for a product).
+// The columns go in chunks of 4 SIMD packets, so the chunk of all k rows stays in the L1 cache.
+inline void trianglerows(const double * l, size_t k, double * b, ptrdiff_t ld, size_t m, bool forward)
+{
+  constexpr int N = packet_size;
+  typedef SIMD<double, N> SIMDT;
+
+  auto row = [&](size_t i) { return b + ptrdiff_t(i)*ld; };
+
+  size_t j = 0;
+  for ( ; j + 4*N <= m; j += 4*N)
+    for (size_t ii = 0; ii < k; ii++)
+    {
+      size_t i = forward ? ii : k-1-ii;
+      const double * li = l + i*k;
+      double * bi = row(i) + j;
+      SIMDT c(li[i]);
+      SIMDT acc0 = c * SIMDT(bi), acc1 = c * SIMDT(bi+N), acc2 = c * SIMDT(bi+2*N), acc3 = c * SIMDT(bi+3*N);
+      for (size_t p = 0; p < i; p++)
+      {
+        SIMDT lp(li[p]);
+        const double * bp = row(p) + j;
+        acc0 = FMA(lp, SIMDT(bp), acc0);
+        acc1 = FMA(lp, SIMDT(bp+N), acc1);
+        acc2 = FMA(lp, SIMDT(bp+2*N), acc2);
+        acc3 = FMA(lp, SIMDT(bp+3*N), acc3);
+      }
+      acc0.Store(bi);
+      acc1.Store(bi+N);
+      acc2.Store(bi+2*N);
+      acc3.Store(bi+3*N);
+    }
+
+  for ( ; j < m; j++)
+    for (size_t ii = 0; ii < k; ii++)
+    {
+      size_t i = forward ? ii : k-1-ii;
+      const double * li = l + i*k;
+      double sum = li[i] * row(i)[j];
+      for (size_t p = 0; p < i; p++)
+        sum += li[p] * row(p)[j];
+      row(i)[j] = sum;
+    }
+}
+
+// B := T^{-1} B (solve set) or B := T B for a triangle of at most trsm_base rows.
+// An upper triangle is a lower one with rows and columns in reverse order, so both go to trianglerows:
+// row i of the kernel is row r(i) of T and B. For the solve, the rows of T are divided by the diagonal.
+template <ORDERING ORDT, ORDERING ORDB>
+void triangleblock(MatrixView<double, ORDT> T, TRIANGLE tri, bool unit, MatrixView<double, ORDB> B, bool solve)
+{
+  size_t k = T.height(), m = B.width();
+  if (k == 0 || m == 0) return;
+  auto r = [&](size_t i) { return tri == Lower ? i : k-1-i; };
+
+  Vector<double, PoolAllocator<double> > l(k*k);
+  for (size_t i = 0; i < k; i++)
+  {
+    double d = unit ? 1.0 : T(r(i), r(i));
+    double scal = solve ? -1.0/d : 1.0;
+    for (size_t p = 0; p < i; p++)
+      l(i*k+p) = scal * T(r(i), r(p));
+    l(i*k+i) = solve ? 1.0/d : d;
+  }
+
+  size_t chunks = (m + trsm_cols - 1) / trsm_cols;
+  ParallelBlocks(chunks, k*k*trsm_cols, [&](size_t first, size_t next) {
+    size_t j0 = first*trsm_cols, j1 = std::min(m, next*trsm_cols);
+    if constexpr (ORDB == RowMajor)
+    {
+      // in place, walking through the rows backwards for an upper triangle
+      ptrdiff_t ld = ptrdiff_t(B.Dist());
+      double * b = &B(r(0), j0);
+      trianglerows(l.Data(), k, b, tri == Lower ? ld : -ld, j1-j0, solve);
+    }
+    else
+    {
+      // the columns of B are copied to rows with unit stride
+      size_t w = std::min(trsm_cols, j1-j0);
+      ArenaLease mem(k*w);
+      double * buf = mem.Data();
+      for (size_t j = j0; j < j1; j += w)
+      {
+        size_t cw = std::min(w, j1-j);
+        for (size_t c = 0; c < cw; c++)
+          for (size_t i = 0; i < k; i++)
+            buf[i*cw + c] = B(r(i), j+c);
+        trianglerows(l.Data(), k, buf, cw, cw, solve);
+        for (size_t c = 0; c < cw; c++)
+          for (size_t i = 0; i < k; i++)
+            B(r(i), j+c) = buf[i*cw + c];
+      }
+    }
+  });
+}
+
+// B := T^{-1} B for the triangle tri of T, halving T until the blocks are small enough for triangleblock
+template <ORDERING ORDT, ORDERING ORDB>
+void trsmrec(MatrixView<double, ORDT> T, TRIANGLE tri, bool unit, MatrixView<double, ORDB> B)
+{
+  size_t k = T.height();
+  if (k <= trsm_base)
+  {
+    triangleblock(T, tri, unit, B, true);
+    return;
+  }
+
+  size_t k1 = k/2, k2 = k-k1;
+  if (tri == Lower)
+  {
+    trsmrec(Block(T, 0, 0, k1, k1), tri, unit, B.Rows(0, k1));
+    MultAddBlocks(B.Rows(k1, k2), Block(T, k1, 0, k2, k1), B.Rows(0, k1), -1.0);
+    trsmrec(Block(T, k1, k1, k2, k2), tri, unit, B.Rows(k1, k2));
+  }
+  else
+  {
+    trsmrec(Block(T, k1, k1, k2, k2), tri, unit, B.Rows(k1, k2));
+    MultAddBlocks(B.Rows(0, k1), Block(T, 0, k1, k1, k2), B.Rows(k1, k2), -1.0);
+    trsmrec(Block(T, 0, 0, k1, k1), tri, unit, B.Rows(0, k1));
+  }
+}
+
+// B := T B for the triangle tri of T; the blocks of B are overwritten only after they were read
+template <ORDERING ORDT, ORDERING ORDB>
+void trmmrec(MatrixView<double, ORDT> T, TRIANGLE tri, bool unit, MatrixView<double, ORDB> B)
+{
+  size_t k = T.height();
+  if (k <= trsm_base)
+  {
+    triangleblock(T, tri, unit, B, false);
+    return;
+  }
+
+  size_t k1 = k/2, k2 = k-k1;
+  if (tri == Lower)
+  {
+    trmmrec(Block(T, k1, k1, k2, k2), tri, unit, B.Rows(k1, k2));
+    MultAddBlocks(B.Rows(k1, k2), Block(T, k1, 0, k2, k1), B.Rows(0, k1), 1.0);
+    trmmrec(Block(T, 0, 0, k1, k1), tri, unit, B.Rows(0, k1));
+  }
+  else
+  {
+    trmmrec(Block(T, 0, 0, k1, k1), tri, unit, B.Rows(0, k1));
+    MultAddBlocks(B.Rows(0, k1), Block(T, 0, k1, k1, k2), B.Rows(k1, k2), 1.0);
+    trmmrec(Block(T, k1, k1, k2, k2), tri, unit, B.Rows(k1, k2));
+  }
+}
+
+
+// B := alpha*T^{-1} B, the solution of T X = alpha*B for all columns of B (BLAS dtrsm)
+template <ORDERING ORDT, ORDERING ORDB>
+void multtrsm(TriangularView<double, ORDT> T, MatrixView<double, ORDB> B, double alpha = 1.0)
+{
+  if (T.height() != B.height())
+    throw std::invalid_argument("multtrsm: right hand sides have wrong height");
+  if (alpha != 1.0) B *= alpha;
+  trsmrec(T.Storage(), T.Triangle(), T.Unit(), B);
+}
+
+// B := alpha*B T^{-1}, the solution of X T = alpha*B for all rows of B: T^T X^T = alpha*B^T
+template <ORDERING ORDB, ORDERING ORDT>
+void multtrsm(MatrixView<double, ORDB> B, TriangularView<double, ORDT> T, double alpha = 1.0)
+{
+  if (T.height() != B.width())
+    throw std::invalid_argument("multtrsm: right hand sides have wrong width");
+  multtrsm(T.transposed(), B.transposed(), alpha);
+}
+
+// B := alpha*T B (BLAS dtrmm)
+template <ORDERING ORDT, ORDERING ORDB>
+void multtrmm(TriangularView<double, ORDT> T, MatrixView<double, ORDB> B, double alpha = 1.0)
+{
+  if (T.height() != B.height())
+    throw std::invalid_argument("multtrmm: matrix shapes are not compatible for multiplication");
+  if (alpha != 1.0) B *= alpha;
+  trmmrec(T.Storage(), T.Triangle(), T.Unit(), B);
+}
+
+// B := alpha*B T
+template <ORDERING ORDB, ORDERING ORDT>
+void multtrmm(MatrixView<double, ORDB> B, TriangularView<double, ORDT> T, double alpha = 1.0)
+{
+  if (T.height() != B.width())
+    throw std::invalid_argument("multtrmm: matrix shapes are not compatible for multiplication");
+  multtrmm(T.transposed(), B.transposed(), alpha);
+}
+
+} // namespace
+#endif
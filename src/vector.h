@@ -1,11 +1,16 @@
 #ifndef FILE_VECTOR_H
 #define FILE_VECTOR_H
 
+#include <cassert>
 #include <exception>
 #include <iostream>
 #include <cmath>
+#include <memory>
+#include <tuple>
+#include <utility>
 
 
+#include "allocator.h"
 #include "forward_decl.h"
 #include "expression.h"
 
@@ -20,7 +25,51 @@ namespace Neo_CLA
     T * data_;
     size_t size_;
     TDIST dist_;
+
+    // data_[i] = op(data_[i], v2(i)) for all i, split across the task pool for large vectors (see expression.h)
+    template <typename TB, typename OP>
+    void Assign (const TB & v2, OP op)
+    {
+      ParallelRanges(size_, [&](size_t first, size_t next) { AssignRange(v2, op, first, next); });
+    }
+
+    // data_[i] = op(data_[i]) for all i
+    template <typename OP>
+    void Apply (OP op)
+    {
+      ParallelRanges(size_, [&](size_t first, size_t next) {
+        for (size_t i = first; i < next; i++)
+          data_[dist_*i] = op(data_[dist_*i]);
+      });
+    }
+
   public:
+    // double vectors with unit stride can be read and written in SIMD packets
+    static constexpr bool packet_ok = std::is_same<T, double>::value
+                                      && std::is_same<TDIST, std::integral_constant<size_t, 1> >::value;
+    static constexpr bool elementwise = true;
+
+    // data_[i] = op(data_[i], v2(i)) for first <= i < next,
+    // in SIMD packets if possible, else element by element
+    template <typename TB, typename OP>
+    void AssignRange (const TB & v2, OP op, size_t first, size_t next)
+    {
+      if constexpr (packet_ok && has_packets<TB>::value)
+      {
+        constexpr int N = packet_size;
+        size_t full = first + (next - first) / N * N;
+        for (size_t i = first; i < full; i += N)
+          op(Neo_HPC::SIMD<double, N>(data_+i), v2.template Packet<N>(i)).Store(data_+i);
+        for (size_t i = full; i < next; i++)
+          data_[i] = op(data_[i], v2(i));
+      }
+      else
+      {
+        for (size_t i = first; i < next; i++)
+          data_[dist_*i] = op(data_[dist_*i], v2(i));
+      }
+    }
+
     VectorView (size_t size, T * data)
       : data_(data), size_(size) { }
     
@@ -39,16 +88,18 @@ namespace Neo_CLA
     
     VectorView & operator= (const VectorView & v2)
     {
-      for (size_t i = 0; i < size_; i++)
-        data_[dist_*i] = v2(i);
+      Assign(v2, [](auto, auto b) { return b; });
       return *this;
     }
 
+    // matrix-vector products are computed by the kernels of matvec.h
     template <typename TB>
     VectorView & operator= (const VectorExpr<TB> & v2)
     {
-      for (size_t i = 0; i < size_; i++)
-        data_[dist_*i] = v2(i);
+      if constexpr (is_prod_matvec_expr<TB>::value)
+        if (AssignMatVec(*this, static_cast<const TB&> (v2), 1.0, 0.0))
+          return *this;
+      Assign(static_cast<const TB&> (v2), [](auto, auto b) { return b; });
       return *this;
     }
 
@@ -63,37 +114,38 @@ namespace Neo_CLA
     template <typename TB>
     VectorView & operator+= (const VectorExpr<TB> & v2)
     {
-      for (size_t i = 0; i < size_; i++)
-        data_[dist_*i] += v2(i);
+      if constexpr (is_prod_matvec_expr<TB>::value)
+        if (AssignMatVec(*this, static_cast<const TB&> (v2), 1.0, 1.0))
+          return *this;
+      Assign(static_cast<const TB&> (v2), [](auto a, auto b) { return a+b; });
       return *this;
     }
 
     template <typename TB>
     VectorView & operator-= (const VectorExpr<TB> & v2)
     {
-      for (size_t i = 0; i < size_; i++)
-        data_[dist_*i] -= v2(i);
+      if constexpr (is_prod_matvec_expr<TB>::value)
+        if (AssignMatVec(*this, static_cast<const TB&> (v2), -1.0, 1.0))
+          return *this;
+      Assign(static_cast<const TB&> (v2), [](auto a, auto b) { return a-b; });
       return *this;
     }
 
     VectorView & operator= (T scal)
     {
-      for (size_t i = 0; i < size_; i++)
-        data_[dist_*i] = scal;
+      Apply([scal](const T &) { return scal; });
       return *this;
     }
 
     VectorView & operator*= (T scal)
     {
-      for (size_t i = 0; i < size_; i++)
-        data_[dist_*i] *= scal;
+      Apply([scal](const T & a) { return a*scal; });
       return *this;
     }
 
     VectorView & operator/= (T scal)
     {
-      for (size_t i = 0; i < size_; i++)
-        data_[dist_*i] /= scal;
+      Apply([scal](const T & a) { return a/scal; });
       return *this;
     }
     
@@ -103,6 +155,8 @@ namespace Neo_CLA
     const size_t Dist() { return dist_; }
     T & operator()(size_t i) { return data_[dist_*i]; }
     const T & operator()(size_t i) const { return data_[dist_*i]; }
+    template <int N>
+    auto Packet (size_t i) const { return Neo_HPC::SIMD<double, N>(data_+i); }
     
     auto Range(size_t first, size_t next) const {
       return VectorView(next-first, dist_, data_+first*dist_);
@@ -122,15 +176,25 @@ namespace Neo_CLA
   
 
   
-  template <typename T = double>
+  // ALLOC provides the memory, 64-byte aligned by default (see allocator.h);
+  // PoolAllocator<T> reuses the memory of previous vectors of the same size
+  template <typename T = double, typename ALLOC = AlignedAllocator<T> >
   class Vector : public VectorView<T>
   {
     typedef VectorView<T> BASE;
     using BASE::size_;
     using BASE::data_;
+
+    static T * Allocate (size_t size)
+    {
+      T * data = ALLOC().allocate(size);
+      std::uninitialized_default_construct_n(data, size);
+      return data;
+    }
+
   public:
     Vector (size_t size) 
-      : VectorView<T> (size, new T[size]) { ; }
+      : VectorView<T> (size, Allocate(size)) { ; }
     
     Vector (const Vector & v)
       : Vector(v.Size())
@@ -154,7 +218,7 @@ namespace Neo_CLA
 
     // initializer list constructor
     Vector (std::initializer_list<T> list)
-    : VectorView<T> (list.size(), new T[list.size()]) {
+    : Vector (list.size()) {
     // copy list
     for (size_t i = 0; i < list.size(); i++){
       data_[i] = list.begin()[i];
@@ -162,20 +226,25 @@ namespace Neo_CLA
     }
     
     
-    ~Vector () { delete [] data_; }
+    ~Vector ()
+    {
+      if (!data_) return;
+      std::destroy_n(data_, size_);
+      ALLOC().deallocate(data_, size_);
+    }
 
     using BASE::operator=;
     Vector & operator=(const Vector & v2)
     {
-      for (size_t i = 0; i < size_; i++)
-        data_[i] = v2(i);
+      BASE::operator= (v2);
       return *this;
     }
 
+    // takes over the buffer of v2, which frees the old one
     Vector & operator= (Vector && v2)
     {
-      for (size_t i = 0; i < size_; i++)
-        data_[i] = v2(i);
+      std::swap(size_, v2.size_);
+      std::swap(data_, v2.data_);
       return *this;
     }
     
@@ -183,6 +252,71 @@ namespace Neo_CLA
 
   
 
+  // FUSED ASSIGNMENTS -----------------------------------------------------------
+  // Fused(Assign(y, y + h*k1), SubAssign(z, h*k2), Assign(w, a*y + b*z)) runs several assignments
+  // in one pass over memory: the index range is cut into blocks that fit into the cache, and all statements
+  // are executed block by block, in the given order. This gives the same result as the separate assignments,
+  // since entry i of an elementwise expression only depends on entries i of its vectors.
+
+  // a deferred assignment target = op(target, expr)
+  template <typename TV, typename TE, typename OP>
+  class VectorStatement
+  {
+    TV target_;
+    expr_storage_t<TE> expr_;
+    OP op_;
+  public:
+    static_assert(has_elementwise<TE>::value, "only elementwise expressions can be fused (no matrix-vector products)");
+
+    VectorStatement (TV target, const TE & expr, OP op)
+      : target_(target), expr_(expr), op_(op) { }
+
+    size_t Size() const { return target_.Size(); }
+    void Run (size_t first, size_t next) { target_.AssignRange(expr_, op_, first, next); }
+  };
+
+  template <typename T, typename TDIST, typename TE>
+  auto Assign (VectorView<T, TDIST> v, const VectorExpr<TE> & e)
+  {
+    return VectorStatement(v, static_cast<const TE&> (e), [](auto, auto b) { return b; });
+  }
+
+  template <typename T, typename TDIST, typename TE>
+  auto AddAssign (VectorView<T, TDIST> v, const VectorExpr<TE> & e)
+  {
+    return VectorStatement(v, static_cast<const TE&> (e), [](auto a, auto b) { return a+b; });
+  }
+
+  template <typename T, typename TDIST, typename TE>
+  auto SubAssign (VectorView<T, TDIST> v, const VectorExpr<TE> & e)
+  {
+    return VectorStatement(v, static_cast<const TE&> (e), [](auto a, auto b) { return a-b; });
+  }
+
+  // entries per block of fused assignments: a few vectors of this size stay in L1/L2-Cache
+  constexpr size_t fused_block = 1024;
+
+  template <typename ...TSTMTS>
+  void Fused (TSTMTS ... stmts)
+  {
+    size_t n = std::get<0>(std::tie(stmts...)).Size();
+    if (((stmts.Size() != n) || ...))
+      throw std::invalid_argument("fused assignments need vectors of the same size");
+
+    ParallelRanges(n, [&](size_t first, size_t next) {
+      // private copies (they are only views), so threads don't share them
+      auto run = [first, next](auto ... mystmts) {
+        for (size_t i = first; i < next; i += fused_block)
+        {
+          size_t blocknext = std::min(next, i + fused_block);
+          (mystmts.Run(i, blocknext), ...);
+        }
+      };
+      run(stmts...);
+    });
+  }
+
+
   template <typename ...Args>
   std::ostream & operator<< (std::ostream & ost, const VectorView<Args...> & v)
   {
@@ -194,94 +328,96 @@ namespace Neo_CLA
   }
 
 
+  // compile-time loop: f(0), f(1), ..., f(N-1)
+  template <typename FUNC, size_t ...I>
+  constexpr void UnrollImpl (FUNC && f, std::index_sequence<I...>) { (f(I), ...); }
+
+  template <size_t N, typename FUNC>
+  constexpr void Unroll (FUNC && f) { UnrollImpl(f, std::make_index_sequence<N>()); }
+
+
   // fixed-size vector
+  // The size is known at compile time: all loops are unrolled and there are no size checks
+  // (sizes of dynamic operands are only asserted in debug builds). Doubles are stored aligned
+  // and padded with zeros to full SIMD packets, so small vectors live in registers.
   template <int SIZE, typename T = double>
   class Vec : public VectorExpr<Vec<SIZE,T>>
   {
-  T data[SIZE];
+    static constexpr bool simd = std::is_same<T, double>::value;
+    static constexpr size_t padded = simd ? (SIZE + packet_size - 1) / packet_size * packet_size : SIZE;
+
+    alignas (simd ? packet_size*sizeof(double) : alignof(T)) T data[padded > 0 ? padded : 1];
 
    public:
-    Vec (){};
+    // expressions refer to Vec operands instead of copying them
+    static constexpr bool owns_data = true;
+    static constexpr bool elementwise = true;
+    static constexpr bool packet_ok = simd;
 
-    Vec (const Vec<SIZE, T> & v2){
-      for (int i=0; i < SIZE; i++){
-        data[i] = v2(i);
-      }
-    }
+    constexpr Vec () : data{} { }
 
-    Vec (T all){
-      for (size_t i=0; i < SIZE; i++){
-        data[i] = all;
-      }
-    };
+    constexpr Vec (const Vec & v2) = default;
 
-    // initializer list constructor
-    Vec (std::initializer_list<T> list){
-      if (list.size() != SIZE) throw std::invalid_argument("initializer list with wrong size");
-      // copy list
-      for (size_t i = 0; i < SIZE; i++){
-        data[i] = list.begin()[i];
-    }
+    constexpr Vec (T all) : data{}
+    {
+      Unroll<SIZE>([&](size_t i) { data[i] = all; });
     }
 
-    // constructor from VectorView
-    template<typename T2, typename TDIST>
-    Vec (VectorView<T2, TDIST> v2){
-      if (v2.Size() != SIZE) throw std::invalid_argument("VectorView has wrong size");
-      // copy list
-      for (size_t i=0; i < SIZE; i++){
-        data[i] = v2(i);
-      }
-    }
+    // Vec<3> v(1, 2, 3) or Vec<3> v = {1, 2, 3}, the number of values is checked at compile time
+    template <typename ...TS, typename = std::enable_if_t<(sizeof...(TS) == SIZE && SIZE > 1 &&
+                                                            std::conjunction_v<std::is_convertible<TS, T>...>)> >
+    constexpr Vec (TS ... vals) : data{ T(vals)... } { }
 
-    // constructor from VecExpr
+    // from vectors and expressions
     template<typename T2>
-    Vec (const VectorExpr<T2> & v2){
-      if (v2.Size() != SIZE) throw std::invalid_argument("VecExpr has wrong size");
-
-      for (int i=0; i < SIZE; i++){
-        data[i] = v2(i);
-      }
+    constexpr Vec (const VectorExpr<T2> & v2) : data{}
+    {
+      *this = v2;
     }
 
-    // VectorView operator=
-    template<typename T2, typename TDIST>
-    Vec & operator= (VectorView<T2, TDIST> v2){
-      if (v2.Size() != SIZE) throw std::invalid_argument("VectorView has wrong size");
-      // copy list
-      for (size_t i=0; i < SIZE; i++){
-        data[i] = v2(i);
-      }
+    constexpr Vec & operator= (const Vec & v2) = default;
+
+    template<typename T2>
+    constexpr Vec & operator= (const VectorExpr<T2> & v2)
+    {
+      const T2 & v = static_cast<const T2&> (v2);
+      assert(v.Size() == SIZE);
+      Unroll<SIZE>([&](size_t i) { data[i] = v(i); });
       return *this;
     }
 
-    Vec & operator= (const Vec<SIZE, T> & v2){
-      for (int i=0; i < SIZE; i++){
-        data[i] = v2(i);
-      }
+    template<typename T2>
+    constexpr Vec & operator+= (const VectorExpr<T2> & v2)
+    {
+      const T2 & v = static_cast<const T2&> (v2);
+      assert(v.Size() == SIZE);
+      Unroll<SIZE>([&](size_t i) { data[i] += v(i); });
       return *this;
     }
 
     template<typename T2>
-    Vec & operator= (const VectorExpr<T2> & v2){
-      if (v2.Size() != SIZE) throw std::invalid_argument("VecExpr has wrong size");
-
-      for (int i=0; i < SIZE; i++){
-        data[i] = v2(i);
-      }
+    constexpr Vec & operator-= (const VectorExpr<T2> & v2)
+    {
+      const T2 & v = static_cast<const T2&> (v2);
+      assert(v.Size() == SIZE);
+      Unroll<SIZE>([&](size_t i) { data[i] -= v(i); });
       return *this;
     }
 
-    T operator() (size_t i) const{
-      return data[i];
+    constexpr Vec & operator*= (T scal)
+    {
+      Unroll<SIZE>([&](size_t i) { data[i] *= scal; });
+      return *this;
     }
 
-    T & operator() (size_t i){
-      return data[i];
-    }
+    constexpr const T & operator() (size_t i) const { return data[i]; }
+    constexpr T & operator() (size_t i) { return data[i]; }
 
-    size_t Size() const {return SIZE;}
+    template <int N>
+    auto Packet (size_t i) const { return Neo_HPC::SIMD<double, N>(data+i); }
 
+    constexpr size_t Size() const { return SIZE; }
+    T * Data() { return data; }
   };
 
     // scalar product
@@ -292,19 +428,16 @@ namespace Neo_CLA
       throw std::invalid_argument("vectors need to have same length for scalar product");
     }
 
-    decltype(T1(0)*T2(0)) product = 0;
-
-    for (size_t i = 0; i < v1.Size(); i++){
-      product += v1(i)*v2(i);
-    }
-
-    return product;
+    if constexpr (std::is_same<T1, double>::value && std::is_same<T2, double>::value)
+      if (UseBlasDot(v1.Size()))
+        return BlasRoutes().dot(v1.Size(), v1.Data(), v1.Dist(), v2.Data(), v2.Dist());
+    return Dot(v1, v2);
   }
 
   // 2-norm for vectors
   template <typename T, typename TDIST>
   auto L2Norm (VectorView<T, TDIST> v){
-    return std::sqrt(v*v);
+    return Norm(v);
   }
   
 }
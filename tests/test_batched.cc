@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <random>
+
+#include "batched.h"
+#include "lapack_interface.h"
+#include "matrix.h"
+
+using namespace Neo_CLA;
+using namespace std;
+
+// a numerical error above the tolerance fails the test
+void checkerror(const char * what, double err, double tol)
+{
+  if (!(err <= tol))
+    {
+      ostringstream msg;
+      msg << what << ": error " << err << " above tolerance " << tol;
+      throw runtime_error(msg.str());
+    }
+}
+
+// random, diagonally dominant matrices, rows shuffled so that the LU needs to pivot
+template <int N>
+MatrixBatch<N, N> randombatch(size_t size)
+{
+  MatrixBatch<N, N> A(size);
+  std::uniform_real_distribution<double> unif(-1, 1);
+  std::default_random_engine re;
+  for (size_t item = 0; item < size; item++)
+  {
+    size_t shift = item % N;
+    for (size_t i = 0; i < N; i++)
+      for (size_t j = 0; j < N; j++)
+        A(item, (i+shift) % N, j) = unif(re) + (i == j ? N : 0);
+  }
+  return A;
+}
+
+// products, solves and inverses agree with the single-item operations
+template <int N>
+void batchtest(size_t size)
+{
+  MatrixBatch<N, N> A = randombatch<N>(size), B = randombatch<N>(size), C(size);
+  MultBatch(C, A, B);
+
+  VectorBatch<N> b(size);
+  for (size_t item = 0; item < size; item++)
+    for (size_t i = 0; i < N; i++)
+      b(item, i, 0) = i+1;
+  VectorBatch<N> x = b;
+
+  LUBatch<N> lu(A);
+  lu.Solve(x);
+  MatrixBatch<N, N> Ainv = lu.Inverse();
+
+  double errmult = 0, errsolve = 0, errinv = 0;
+  for (size_t item = 0; item < size; item++)
+  {
+    Mat<N, N> Ai = A.Get(item), Ci = A.Get(item) * B.Get(item), I = Ai * Ainv.Get(item);
+    Mat<N, 1> r = Ai * x.Get(item) - b.Get(item);
+    for (size_t i = 0; i < N; i++)
+    {
+      errsolve = std::max(errsolve, std::abs(r(i, 0)));
+      for (size_t j = 0; j < N; j++)
+      {
+        errmult = std::max(errmult, std::abs(C(item, i, j) - Ci(i, j)));
+        errinv = std::max(errinv, std::abs(I(i, j) - (i == j)));
+      }
+    }
+  }
+  cout << N << "x" << N << ", " << size << " items: product error " << errmult
+       << ", residual " << errsolve << ", A*Inverse(A) - I " << errinv << endl;
+  checkerror("batched product", errmult, 1e-12);
+  checkerror("batched solve", errsolve, 1e-10);
+  checkerror("batched inverse", errinv, 1e-10);
+}
+
+// many small systems: batched against one LapackLU per item
+template <int N>
+void timing(size_t size)
+{
+  MatrixBatch<N, N> A = randombatch<N>(size);
+  VectorBatch<N> b(size);
+  for (size_t item = 0; item < size; item++)
+    for (size_t i = 0; i < N; i++)
+      b(item, i, 0) = 1;
+
+  auto start = chrono::high_resolution_clock::now();
+  LUBatch<N> lu(A);
+  lu.Solve(b);
+  auto end = chrono::high_resolution_clock::now();
+  double tbatch = chrono::duration<double>(end-start).count();
+
+  Matrix<double> Ai(N, N);
+  Vector<double> bi(N);
+  start = chrono::high_resolution_clock::now();
+  for (size_t item = 0; item < size; item++)
+  {
+    for (size_t i = 0; i < N; i++)
+    {
+      bi(i) = 1;
+      for (size_t j = 0; j < N; j++)
+        Ai(i, j) = A(item, i, j);
+    }
+    LapackLU<RowMajor> lapacklu(Ai);
+    lapacklu.Solve(bi);
+  }
+  end = chrono::high_resolution_clock::now();
+  double tlapack = chrono::duration<double>(end-start).count();
+
+  cout << N << "x" << N << " solve, " << size << " items: batched " << tbatch << " s, LapackLU " << tlapack
+       << " s, speedup " << tlapack/tbatch << endl;
+}
+
+int main()
+{
+  try
+    {
+      batchtest<3>(1001);
+      batchtest<6>(1001);
+      batchtest<12>(1001);
+
+      timing<3>(200000);
+      timing<6>(200000);
+      timing<12>(50000);
+    }
+  catch (const exception & err)
+    {
+      cerr << "ERROR CAUGHT: " << err.what() << endl;
+      return 1;
+    }
+
+  return 0;
+}
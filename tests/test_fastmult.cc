@@ -1,3 +1,4 @@
+#include <array>
 #include <chrono>
 #include <cmath>
 #include <functional>
@@ -5,6 +6,7 @@
 #include <ostream>
 
 #include "fastmult.h"
+#include "lapack_interface.h"
 #include "matrix.h"
 
 
@@ -85,11 +87,276 @@ void performance_test(){
   std::cout << "max error: " << std::max(std::abs(*min), std::abs(*max)) << std::endl;
 }
 
+// products in the expression syntax are computed with the blocked kernels, too
+void expression_test(){
+
+  size_t n = 1000;
+
+  Matrix<> A = randommatrix<>(n, n);
+  Matrix<double, ColMajor> B = randommatrix<ColMajor>(n, n);
+  Matrix<> C (n, n);
+  C = 0;
+  multcachy(C, A, Matrix<>(B));
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  Matrix<> D = A*B; // the computation
+
+  auto end = std::chrono::high_resolution_clock::now();
+  double time = std::chrono::duration<double>(end-start).count();
+
+  std::cout << "expression: n = " << n << ", time = " << time << " s, GFlops = " << (n*n*(n - 1))/(time*1e9) << std::endl;
+
+  // the result must not depend on the ordering or on aliasing
+  Matrix<> E = A;
+  E = E*B;
+  D = D - C;
+  E = E - C;
+  const auto [min, max] = std::minmax_element(D.Data(), D.Data() + n*n);
+  const auto [minE, maxE] = std::minmax_element(E.Data(), E.Data() + n*n);
+  std::cout << "max error: " << std::max(std::abs(*min), std::abs(*max))
+            << ", max error with aliasing: " << std::max(std::abs(*minE), std::abs(*maxE)) << std::endl;
+}
+
+// the task pool is started once, so parallel products of small matrices stay cheap
+void overhead_test(){
+
+  StartTaskPool();
+  std::cout << "task pool with " << NumThreads() << " threads" << std::endl;
+
+  // the pool can't be resized under a running kernel
+  RunParallel(1, [](int, int){
+    try { SetNumThreads(2); }
+    catch (const std::logic_error & err) { std::cout << "resize during RunParallel: " << err.what() << std::endl; }
+  });
+
+  for (size_t n : {16, 32, 64, 128, 256})
+  {
+    Matrix<> A = randommatrix<>(n, n);
+    Matrix<> B = randommatrix<>(n, n);
+    Matrix<> C (n, n);
+    C = 0;
+
+    size_t runs = size_t (1e8 / (n*n*n)) + 1;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < runs; i++)
+      multcachy(C, A, B);
+    auto end = std::chrono::high_resolution_clock::now();
+    double time_cachy = std::chrono::duration<double>(end-start).count() / runs;
+
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < runs; i++)
+      multparallel(C, A, B);
+    end = std::chrono::high_resolution_clock::now();
+    double time_parallel = std::chrono::duration<double>(end-start).count() / runs;
+
+    std::cout << "n = " << n << ", multcachy: " << time_cachy*1e6 << " us/call, multparallel: "
+              << time_parallel*1e6 << " us/call" << std::endl;
+  }
+}
+
+// GFlops of multparallel for an increasing number of threads
+void scaling_test(size_t n){
+
+  Matrix<> A = randommatrix<>(n, n);
+  Matrix<> B = randommatrix<>(n, n);
+  Matrix<> C (n, n);
+
+  for (size_t threads = 1; threads <= std::thread::hardware_concurrency(); threads *= 2)
+  {
+    SetNumThreads(threads);
+    C = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    multparallel(C, A, B);
+    auto end = std::chrono::high_resolution_clock::now();
+    double time = std::chrono::duration<double>(end-start).count();
+
+    std::cout << "n = " << n << ", threads = " << threads << ", GFlops = " << (n*n*(n - 1))/(time*1e9) << std::endl;
+  }
+  SetNumThreads(0);
+}
+
+// packing A and B (multpacked) vs. packing only A (multcachy) vs. Lapack
+void packed_test(){
+
+  for (size_t n : {100, 500, 1000, 2000})
+  {
+    Matrix<> A = randommatrix<>(n, n);
+    Matrix<> B = randommatrix<>(n, n);
+    Matrix<> C (n, n);
+
+    size_t runs = size_t (1e9 / (n*n*n)) + 1;
+    double flops = double(n)*n*n*runs;
+
+    auto timeit = [&](auto func){
+      auto start = std::chrono::high_resolution_clock::now();
+      for (size_t i = 0; i < runs; i++)
+        func();
+      auto end = std::chrono::high_resolution_clock::now();
+      return flops/std::chrono::duration<double>(end-start).count()*1e-9;
+    };
+
+    double gf_cachy = timeit([&](){ C = 0; multcachy(C, A, B); });
+    double gf_packed = timeit([&](){ C = 0; multpacked(C, A, B); });
+    double gf_lapack = timeit([&](){ MultMatMatLapack(A, B, C); });
+
+    std::cout << "n = " << n << ", GFlops multcachy: " << gf_cachy << ", multpacked: " << gf_packed
+              << ", lapack: " << gf_lapack << std::endl;
+  }
+}
+
+// all micro-kernels this CPU supports, the first one is used by default
+void kernel_test(){
+
+  size_t n = 1000;
+
+  Matrix<> A = randommatrix<>(n, n);
+  Matrix<> B = randommatrix<>(n, n);
+  Matrix<> C (n, n);
+
+  std::string active = ActiveMicroKernel().name;
+  std::cout << "active kernel: " << active
+            << (EnvironmentGemmProfile() ? " (from NEO_CLA_GEMM_PROFILE)" : " (built-in default)") << std::endl;
+
+  for (const MicroKernel & kernel : AvailableMicroKernels())
+  {
+    SetMicroKernel(kernel.name);
+    C = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    multpacked(C, A, B);
+    auto end = std::chrono::high_resolution_clock::now();
+    double time = std::chrono::duration<double>(end-start).count();
+
+    std::cout << "kernel " << kernel.name << " (" << kernel.mr << "x" << kernel.nr << "): n = " << n
+              << ", GFlops = " << (n*n*(n - 1))/(time*1e9) << std::endl;
+  }
+
+  SetMicroKernel(active);
+}
+
+// C = alpha*op(A)*op(B) + beta*C for all orderings, compared to the expression evaluated entry by entry
+template <ORDERING ORDC, ORDERING ORDA, ORDERING ORDB>
+void gemm_test(size_t m, size_t n, size_t k){
+
+  Matrix<double, ORDA> A = randommatrix<ORDA>(k, m);
+  Matrix<double, ORDB> B = randommatrix<ORDB>(k, n);
+  Matrix<double, ORDC> C = randommatrix<ORDC>(m, n);
+
+  Matrix<> D (m, n);
+  for (size_t i = 0; i < m; i++)
+    for (size_t j = 0; j < n; j++)
+    {
+      double sum = 0;
+      for (size_t l = 0; l < k; l++)
+        sum += A(l, i) * B(l, j);
+      D(i, j) = 2*sum - 0.5*C(i, j);
+    }
+
+  multgemm(C, A.transposed(), B, 2.0, -0.5);
+
+  double err = 0;
+  for (size_t i = 0; i < m; i++)
+    for (size_t j = 0; j < n; j++)
+      err = std::max(err, std::abs(C(i, j) - D(i, j)));
+
+  std::cout << "gemm " << (ORDC == RowMajor ? "R" : "C") << (ORDA == RowMajor ? "R" : "C")
+            << (ORDB == RowMajor ? "R" : "C") << ": max error " << err << std::endl;
+}
+
+// awkward sizes, where the edges of C are not covered by full blocks
+void edge_test(){
+
+  for (auto [m, n, k] : {std::array<size_t, 3>{1000, 1008, 1000}, {1001, 997, 999}, {1003, 1000, 998}, {7, 16, 5}})
+  {
+    Matrix<> A = randommatrix<>(m, k);
+    Matrix<> B = randommatrix<>(k, n);
+    Matrix<> C (m, n);
+    Matrix<> D (m, n);
+
+    D = 0;
+    multpacked(D, A, B);
+
+    // GFlops and max error compared to multpacked
+    auto check = [&](auto func){
+      C = 0;
+      auto start = std::chrono::high_resolution_clock::now();
+      func();
+      auto end = std::chrono::high_resolution_clock::now();
+      double time = std::chrono::duration<double>(end-start).count();
+
+      double err = 0;
+      for (size_t i = 0; i < m; i++)
+        for (size_t j = 0; j < n; j++)
+          err = std::max(err, std::abs(C(i, j) - D(i, j)));
+      return std::pair((m*n*(k - 1))/(time*1e9), err);
+    };
+
+    auto [gf_matmat, err_matmat] = check([&](){ multmatmat(C, A, B); });
+    auto [gf_cachy, err_cachy] = check([&](){ multcachy(C, A, B); });
+    auto [gf_packed, err_packed] = check([&](){ multpacked(C, A, B); });
+
+    std::cout << m << "x" << n << "x" << k << ": GFlops (max error) multmatmat: " << gf_matmat << " (" << err_matmat
+              << "), multcachy: " << gf_cachy << " (" << err_cachy << "), multpacked: " << gf_packed << std::endl;
+  }
+}
+
+// block sizes that would not fit on the stack of a worker thread
+void arena_test(){
+
+  size_t n = 1200;
+  Matrix<> A = randommatrix<>(n, n);
+  Matrix<> B = randommatrix<>(n, n);
+  Matrix<> C (n, n);
+  Matrix<> D (n, n);
+
+  D = 0;
+  multpacked(D, A, B);
+
+  for (size_t bs : {96, 512, 1024})
+  {
+    C = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    if (bs == 96) multcachy(C, A, B);
+    else if (bs == 512) multcachy<RowMajor, std::integral_constant<size_t, 512>, std::integral_constant<size_t, 512> >(C, A, B);
+    else multcachy<RowMajor, std::integral_constant<size_t, 1024>, std::integral_constant<size_t, 1024> >(C, A, B);
+    auto end = std::chrono::high_resolution_clock::now();
+    double time = std::chrono::duration<double>(end-start).count();
+
+    double err = 0;
+    for (size_t i = 0; i < n; i++)
+      for (size_t j = 0; j < n; j++)
+        err = std::max(err, std::abs(C(i, j) - D(i, j)));
+
+    std::cout << "multcachy " << bs << "x" << bs << " blocks: GFlops: " << (n*n*(n - 1))/(time*1e9)
+              << ", max error: " << err << ", arena: " << PackingArena::Local().Size()*sizeof(double)/1024 << " kB" << std::endl;
+  }
+
+  // the arena is reused, a second product does not allocate again
+  size_t size = PackingArena::Local().Size();
+  C = 0;
+  multparallel(C, A, B);
+  std::cout << "arena reused: " << (PackingArena::Local().Size() == size ? "yes" : "no (grown)") << std::endl;
+}
+
 
 int main (){
 
   // correctness_test();
   performance_test();
+  expression_test();
+  overhead_test();
+  scaling_test(1000); // try 4000 on a large machine
+  packed_test();
+  kernel_test();
+  edge_test();
+  arena_test();
+  gemm_test<RowMajor, RowMajor, RowMajor>(101, 97, 103);
+  gemm_test<RowMajor, ColMajor, ColMajor>(101, 97, 103);
+  gemm_test<ColMajor, RowMajor, ColMajor>(101, 97, 103);
+  gemm_test<ColMajor, ColMajor, RowMajor>(101, 97, 103);
 
   return 0;
 }
\ No newline at end of file
@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
 #include <chrono>
 
 #include <vector.h>
@@ -8,6 +12,17 @@
 using namespace Neo_CLA;
 using namespace std;
 
+// a numerical error above the tolerance fails the test
+void checkerror(const char * what, double err, double tol)
+{
+  if (!(err <= tol))
+    {
+      ostringstream msg;
+      msg << what << ": error " << err << " above tolerance " << tol;
+      throw runtime_error(msg.str());
+    }
+}
+
 void testmatmul() {
   Matrix<double> A (4, 3, {0, 0, 1,
                             0, 1, 0,
@@ -122,10 +137,367 @@ int LUtests() {
   return 0;                              
 }
 
+// the native LU against LAPACK
+void nativeLUtests() {
+  for (size_t n : {4, 100, 1000})
+    {
+      Matrix<double> A = randommatrix<>(n, n);
+      Vector<double> b(n), bnative(n);
+      for (size_t i = 0; i < n; i++)
+        b(i) = bnative(i) = i % 3;
+
+      auto start = std::chrono::high_resolution_clock::now();
+      LUFactorization<RowMajor> lapacklu(A, LapackBackend);
+      auto end = std::chrono::high_resolution_clock::now();
+      double tlapack = std::chrono::duration<double>(end-start).count();
+
+      start = std::chrono::high_resolution_clock::now();
+      LUFactorization<RowMajor> nativelu(A, NativeBackend);
+      end = std::chrono::high_resolution_clock::now();
+      double tnative = std::chrono::duration<double>(end-start).count();
+
+      lapacklu.Solve(b);
+      nativelu.Solve(bnative);
+      double diffsolve = 0, difffactors = 0;
+      for (size_t i = 0; i < n; i++)
+        diffsolve = max(diffsolve, abs(b(i) - bnative(i)));
+
+      Matrix<double, ColMajor> L = lapacklu.LFactor(), Lnative = nativelu.LFactor();
+      Matrix<double, ColMajor> U = lapacklu.UFactor(), Unative = nativelu.UFactor();
+      Matrix<double, ColMajor> P = lapacklu.PFactor(), Pnative = nativelu.PFactor();
+      for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j < n; j++)
+          difffactors = max({difffactors, abs(L(i, j) - Lnative(i, j)), abs(U(i, j) - Unative(i, j)),
+                             abs(P(i, j) - Pnative(i, j))});
+
+      cout << "n = " << n << ": dgetrf " << tlapack << " s, native " << tnative << " s, "
+           << "difference of the solutions " << diffsolve << ", of the factors " << difffactors << endl;
+      checkerror("native LU solve against LAPACK", diffsolve, 1e-10);
+      checkerror("native LU factors against LAPACK", difffactors, 1e-6);
+    }
+}
+
+// A = P L U from the views of both backends, against the dense copies
+void factorviewtests() {
+  size_t n = 1000;
+  Matrix<double> A = randommatrix<>(n, n);
+
+  for (LU_BACKEND backend : {LapackBackend, NativeBackend})
+    {
+      LUFactorization<RowMajor> lu(A, backend);
+
+      auto start = std::chrono::high_resolution_clock::now();
+      Matrix<double, ColMajor> L = lu.LFactor(), U = lu.UFactor(), P = lu.PFactor();
+      auto end = std::chrono::high_resolution_clock::now();
+      double tcopies = std::chrono::duration<double>(end-start).count();
+
+      double err = 0, tviews = 0;
+      lu.Visit([&](auto & f) {
+        start = std::chrono::high_resolution_clock::now();
+        auto Lv = f.LView();
+        auto Uv = f.UView();
+        auto Pv = f.PView();
+        end = std::chrono::high_resolution_clock::now();
+        tviews = std::chrono::duration<double>(end-start).count();
+
+        // P L U from the views: U copied, then multiplied by L and permuted in place
+        Matrix<double, ColMajor> PLU = Uv;
+        multtrmm(Lv, PLU.View());
+        Pv.Apply(PLU.View());
+
+        std::vector<size_t> perm = Pv.Indices();
+        for (size_t i = 0; i < n; i++)
+          for (size_t j = 0; j < n; j++)
+            err = max({err, abs(PLU(i, j) - A(i, j)) / 100, abs(Lv(i, j) - L(i, j)), abs(Uv(i, j) - U(i, j)),
+                       abs(P(i, j) - (perm[j] == i ? 1.0 : 0.0))});
+
+        // P x moves x(k) to row perm[k], P^T moves it back
+        Vector<double> x(n), y(n);
+        for (size_t i = 0; i < n; i++)
+          x(i) = y(i) = i;
+        Pv.Apply(y.View());
+        for (size_t k = 0; k < n; k++)
+          err = max(err, abs(y(perm[k]) - x(k)));
+        Pv.Apply(y.View(), true);
+        for (size_t i = 0; i < n; i++)
+          err = max(err, abs(y(i) - x(i)));
+
+        // Inverse works on a copy, the views still reference the factors
+        Matrix<double, ColMajor> inv = f.Inverse();
+        for (size_t i = 0; i < n; i++)
+          for (size_t j = 0; j < n; j++)
+            err = max({err, abs(Lv(i, j) - L(i, j)), abs(Uv(i, j) - U(i, j))});
+      });
+
+      cout << (backend == LapackBackend ? "LapackLU" : "NativeLU") << ", n = " << n << ": L, U, P copied "
+           << tcopies << " s, views " << tviews << " s, error of P L U " << err << endl;
+      checkerror("LU factor views", err, 1e-10);
+    }
+}
+
+// many right hand sides at once, for both orderings, transposed systems and both backends
+template <ORDERING ORDB>
+double multisolve(LU_BACKEND backend, bool transposed, size_t n, size_t k)
+{
+  Matrix<double> A = randommatrix<>(n, n);
+  Matrix<double, ORDB> X = randommatrix<ORDB>(n, k);
+  Matrix<double, ORDB> B(n, k);
+  if (transposed)
+    B = A.transposed() * X;
+  else
+    B = A * X;
+
+  LUFactorization<RowMajor> lu(A, backend);
+  lu.Solve(B.View(), transposed);
+
+  double err = 0;
+  for (size_t i = 0; i < n; i++)
+    for (size_t j = 0; j < k; j++)
+      err = max(err, abs(B(i, j) - X(i, j)) / 100);
+  checkerror("LU solve with many right hand sides", err, 1e-9);
+  return err;
+}
+
+void multiRHStests() {
+  for (LU_BACKEND backend : {LapackBackend, NativeBackend})
+    for (bool transposed : {false, true})
+      cout << (backend == LapackBackend ? "LapackLU" : "NativeLU") << (transposed ? ", A^T X = B" : ", A X = B")
+           << ": error RowMajor B " << multisolve<RowMajor>(backend, transposed, 200, 37)
+           << ", ColMajor B " << multisolve<ColMajor>(backend, transposed, 200, 37) << endl;
+
+  // one call for all columns against one call per column
+  size_t n = 1000, k = 1000;
+  Matrix<double> A = randommatrix<>(n, n);
+  Matrix<double, ColMajor> B = randommatrix<ColMajor>(n, k);
+  LapackLU lu(A);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  for (size_t j = 0; j < k; j++)
+    lu.Solve(B.Col(j));
+  auto end = std::chrono::high_resolution_clock::now();
+  double tcols = std::chrono::duration<double>(end-start).count();
+
+  start = std::chrono::high_resolution_clock::now();
+  lu.Solve(B.View());
+  end = std::chrono::high_resolution_clock::now();
+  double tmat = std::chrono::duration<double>(end-start).count();
+  cout << n << " right hand sides: column by column " << tcols << " s, at once " << tmat << " s" << endl;
+}
+
+// scalar products and norms compared to BLAS
+int dottests() {
+
+  for (size_t n : {1000, 100000, 10000000})
+    {
+      Vector<double> x(n), y(n);
+      for (size_t i = 0; i < n; i++)
+        {
+          x(i) = 1.0/(i+1);
+          y(i) = (i % 7) - 3.0;
+        }
+
+      size_t runs = 100000000 / n + 1;
+      integer nn = n, inc = 1;
+      double sum = 0;
+      auto start = std::chrono::high_resolution_clock::now();
+      for (size_t r = 0; r < runs; r++)
+        sum += ddot_(&nn, x.Data(), &inc, y.Data(), &inc);
+      auto end = std::chrono::high_resolution_clock::now();
+      double tblas = std::chrono::duration<double>(end-start).count();
+      double dotblas = sum/runs;
+
+      for (SUMMATION mode : {FastSum, PairwiseSum, KahanSum})
+        {
+          Summation() = mode;
+          sum = 0;
+          start = std::chrono::high_resolution_clock::now();
+          for (size_t r = 0; r < runs; r++)
+            sum += x*y;
+          end = std::chrono::high_resolution_clock::now();
+          double time = std::chrono::duration<double>(end-start).count();
+
+          const char * name[] = {"fast", "kahan", "pairwise"};
+          cout << "n = " << n << ", " << name[mode] << ": " << 2*n*runs/time*1e-9 << " GFlops (ddot: "
+               << 2*n*runs/tblas*1e-9 << "), difference to ddot: " << sum/runs - dotblas << endl;
+          checkerror("x*y against ddot", abs(sum/runs - dotblas), 1e-12);
+        }
+      Summation() = FastSum;
+    }
+
+  // cancellation: only the compensated sum gets the exact result 1
+  Vector<double> x = {1e16, 1.0, -1e16};
+  Vector<double> y = {1.0, 1.0, 1.0};
+  for (SUMMATION mode : {FastSum, KahanSum})
+    {
+      Summation() = mode;
+      cout << (mode == KahanSum ? "kahan" : "fast") << ": (1e16 + 1 - 1e16) = " << x*y << endl;
+    }
+  checkerror("kahan cancellation", abs(x*y - 1), 0);
+
+  // rounding errors of the products, with or without FMA: 5 (1+e)(1-e) - 5 = -5 e^2 = -5 * 2^-60
+  double e = std::ldexp(1.0, -30);
+  Vector<double> u = {1+e, 1+e, 1+e, 1+e, 1+e, -1, -1, -1, -1, -1};
+  Vector<double> v = {1-e, 1-e, 1-e, 1-e, 1-e, 1, 1, 1, 1, 1};
+  for (SUMMATION mode : {FastSum, KahanSum})
+    {
+      Summation() = mode;
+      cout << (mode == KahanSum ? "kahan" : "fast") << ": 5 (1+e)(1-e) - 5 = " << u*v << " (exact "
+           << -5*e*e << ")" << endl;
+    }
+  checkerror("kahan product rounding", abs(u*v + 5*e*e), 0);
+  Summation() = FastSum;
+
+  // no overflow or underflow in the norm
+  for (double scale : {1.0, 1e200, 1e-200})
+    {
+      Vector<double> v = {3*scale, 4*scale};
+      integer n = 2, inc = 1;
+      cout << "norm of (3, 4) * " << scale << " = " << L2Norm(v) << ", dnrm2: " << dnrm2_(&n, v.Data(), &inc) << endl;
+      checkerror("scaled norm", abs(L2Norm(v) / (5*scale) - 1), 1e-15);
+    }
+
+  return 0;
+}
+
+// BLAS-1/2 wrappers against the native operations, both orderings and strided vectors
+template <ORDERING ORD>
+void blaswrappers(size_t n)
+{
+  Matrix<double, ORD> A = randommatrix<ORD>(n, n);
+  Vector<double> xs(2*n), ys(2*n);
+  for (size_t i = 0; i < 2*n; i++)
+    {
+      xs(i) = sin(i);
+      ys(i) = cos(i);
+    }
+  auto x = xs.Slice(0, 2);
+  auto y = ys.Slice(1, 2);
+  Vector<double> r(n), s(n), v(n);
+
+  double errdot = abs(InnerProductLapack(x, y) - Dot(x, y)) + abs(NormLapack(x) - Norm(x));
+
+  // gemv with beta, by the wrapper and natively
+  BlasRoutes().gemv_threshold = size_t(-1);
+  r = y;
+  MultMatVecLapack(A.View(), x, r.View(), 2.0, 0.5);
+  s = 0.5*y;
+  s += 2.0*(A*x);
+  double errgemv = L2Norm(r-s);
+
+  // rank-1 update
+  Matrix<double, ORD> B = A;
+  RankOneUpdateLapack(3.0, x, y, B.View());
+  double errger = 0;
+  for (size_t i = 0; i < n; i++)
+    for (size_t j = 0; j < n; j++)
+      errger = max(errger, abs(B(i, j) - A(i, j) - 3*x(i)*y(j)));
+
+  // triangular products and solves, symmetric product: compare with the dense matrices
+  double errtri = 0, errsym = 0;
+  for (bool lower : {true, false})
+    for (bool unit : {true, false})
+      {
+        // T is the triangle of Ta, the other triangle (and a unit diagonal) of Ta must not be used
+        Matrix<double, ORD> T(n, n), Ta = A;
+        T = 0.0;
+        for (size_t i = 0; i < n; i++)
+          for (size_t j = 0; j < n; j++)
+            if (lower ? j < i : j > i) T(i, j) = Ta(i, j) = A(i, j) / n;
+            else if (i == j)
+              {
+                Ta(i, j) = unit ? 17.0 : 2.0 + A(i, j);
+                T(i, j) = unit ? 1.0 : Ta(i, j);
+              }
+        for (size_t i = 0; i < n; i++) r(i) = x(i);
+        MultTriangularLapack(Ta.View(), r.View(), lower, unit);
+        s = T*x;
+        errtri = max(errtri, L2Norm(r-s));
+        SolveTriangularLapack(Ta.View(), r.View(), lower, unit);
+        for (size_t i = 0; i < n; i++) r(i) -= x(i);
+        errtri = max(errtri, L2Norm(r));
+      }
+  for (bool lower : {true, false})
+    {
+      Matrix<double, ORD> S(n, n);
+      for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j < n; j++)
+          S(i, j) = (lower ? j <= i : j >= i) ? A(i, j) : A(j, i);
+      MultSymMatVecLapack(A.View(), x, r.View(), lower);
+      s = S*x;
+      errsym = max(errsym, L2Norm(r-s));
+    }
+  BlasRoutes().gemv_threshold = BlasDispatch().gemv_threshold;
+
+  cout << (ORD == RowMajor ? "RowMajor" : "ColMajor") << ", n = " << n << ": error dot/nrm2 " << errdot
+       << ", gemv " << errgemv << ", ger " << errger << ", trmv/trsv " << errtri << ", symv " << errsym << endl;
+  checkerror("dot/nrm2 wrappers", errdot, 1e-12);
+  checkerror("gemv wrapper", errgemv, 1e-10);
+  checkerror("ger wrapper", errger, 1e-12);
+  checkerror("trmv/trsv wrappers", errtri, 1e-10);
+  checkerror("symv wrapper", errsym, 1e-10);
+}
+
+// A*x and x*y with and without the routes to BLAS
+void dispatchtests() {
+  blaswrappers<RowMajor>(53);
+  blaswrappers<ColMajor>(53);
+
+  for (size_t n : {8, 32, 256, 2048})
+    {
+      Matrix<double, ColMajor> A = randommatrix<ColMajor>(n, n);
+      Vector<double> x(n), y(n), z(n);
+      for (size_t i = 0; i < n; i++) x(i) = 1.0/(i+1);
+      size_t runs = 100000000 / (n*n) + 1;
+
+      BlasRoutes().gemv_threshold = size_t(-1);
+      auto start = std::chrono::high_resolution_clock::now();
+      for (size_t r = 0; r < runs; r++)
+        y = A*x;
+      auto end = std::chrono::high_resolution_clock::now();
+      double tnative = std::chrono::duration<double>(end-start).count();
+
+      BlasRoutes().gemv_threshold = 0;
+      start = std::chrono::high_resolution_clock::now();
+      for (size_t r = 0; r < runs; r++)
+        z = A*x;
+      end = std::chrono::high_resolution_clock::now();
+      double tblas = std::chrono::duration<double>(end-start).count();
+
+      cout << "ColMajor A*x, n = " << n << ": native " << 2*n*n*runs/tnative*1e-9 << " GFlops, dgemv route "
+           << 2*n*n*runs/tblas*1e-9 << " GFlops, difference " << L2Norm(y-z) << endl;
+      checkerror("A*x through dgemv", L2Norm(y-z), 1e-10);
+    }
+  BlasRoutes().gemv_threshold = BlasDispatch().gemv_threshold;
+
+  // x*y goes to ddot above the threshold, but only for the default summation
+  Vector<double> x = {1e16, 1.0, -1e16};
+  Vector<double> y = {1.0, 1.0, 1.0};
+  BlasRoutes().dot_threshold = 0;
+  Summation() = KahanSum;
+  cout << "kahan with the ddot route: (1e16 + 1 - 1e16) = " << x*y << endl;
+  checkerror("kahan with the ddot route", abs(x*y - 1), 0);
+  Summation() = FastSum;
+  cout << "x*y through ddot: " << x*y << ", InnerProductLapack: " << InnerProductLapack(x.View(), y.View()) << endl;
+  BlasRoutes().dot_threshold = BlasDispatch().dot_threshold;
+}
+
 int main()
 {
-  // timematmul(100);
-  LUtests();
+  try
+    {
+      // timematmul(100);
+      LUtests();
+      nativeLUtests();
+      factorviewtests();
+      multiRHStests();
+      dottests();
+      dispatchtests();
+    }
+  catch (const exception & err)
+    {
+      cerr << "ERROR CAUGHT: " << err.what() << endl;
+      return 1;
+    }
 
   return 0;
 }
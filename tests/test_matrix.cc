@@ -1,3 +1,5 @@
+#include <chrono>
+#include <cmath>
 #include <iostream>
 #include <exception>
 
@@ -5,6 +7,7 @@
 #include "matrix_expression.h"
 #include "vector.h"
 #include "simd.h"
+#include "lu.h"
 
 namespace cla = Neo_CLA;
 
@@ -134,6 +137,177 @@ void inverse_tests(){
   
   std::cout << cla::Inverse(B) << std::endl << cla::Inverse(B)*B << std::endl;
 
+  // other entry types use Gauss-Jordan elimination, which pivots if the diagonal entry vanishes
+  cla::Matrix<float> F (3, 3, {0, 1, 2,
+                               1, 0, 3,
+                               4, -3, 8});
+  std::cout << cla::Inverse(F) << std::endl << cla::Inverse(F)*F << std::endl;
+
+  // large matrices go through the blocked LU (see lu.h)
+  size_t n = 500;
+  cla::Matrix<double, cla::ColMajor> C = cla::randommatrix<cla::ColMajor>(n, n);
+  cla::Matrix<double, cla::ColMajor> Cinv = C;
+  auto start = std::chrono::high_resolution_clock::now();
+  cla::InvertInPlace(Cinv.View());
+  auto end = std::chrono::high_resolution_clock::now();
+
+  cla::Matrix<double, cla::ColMajor> I = C*Cinv;
+  double err = 0;
+  for (size_t i = 0; i < n; i++)
+    for (size_t j = 0; j < n; j++)
+      err = std::max(err, std::abs(I(i, j) - (i == j)));
+  std::cout << n << "x" << n << " inverse: " << std::chrono::duration<double>(end-start).count()
+            << " s, max error of C*Inverse(C): " << err << std::endl;
+
+  // any allocator takes the LU route, Gauss-Jordan is used without it (programs without lu.h)
+  cla::Matrix<double, cla::ColMajor, cla::PoolAllocator<double> > G = cla::randommatrix<cla::ColMajor>(50, 50);
+  cla::Matrix<double, cla::ColMajor, cla::PoolAllocator<double> > Glu = cla::Inverse(G);
+  cla::KernelDispatch routes = cla::KernelRoutes();
+  cla::KernelRoutes().invert = nullptr;
+  cla::Matrix<double, cla::ColMajor, cla::PoolAllocator<double> > Ggj = cla::Inverse(G);
+  cla::KernelRoutes() = routes;
+  double errgj = 0;
+  for (size_t i = 0; i < 50; i++)
+    for (size_t j = 0; j < 50; j++)
+      errgj = std::max(errgj, std::abs(Glu(i, j) - Ggj(i, j)));
+  std::cout << "pool allocated 50x50 inverse, LU against Gauss-Jordan: " << errgj << std::endl;
+  if (errgj > 1e-8)
+    throw std::runtime_error("Inverse: LU and Gauss-Jordan disagree");
+
+  try{
+    cla::Inverse(cla::Matrix<double> (2, 2, {1, 2,
+                                              2, 4}));
+  }
+  catch (const std::logic_error & err){
+    std::cout << "singular matrix: " << err.what() << std::endl;
+  }
+}
+
+// fixed-size matrices and vectors
+void fixed_size_tests(){
+  constexpr cla::Mat<2, 3> A = {1, 2, 3,
+                                4, 5, 6};
+  constexpr cla::Vec<3> x(1, 1, 1);
+  constexpr cla::Vec<2> y = A * x;
+  static_assert(y(0) == 6 && y(1) == 15, "Mat * Vec is evaluated at compile time");
+
+  constexpr cla::Mat<2, 2> AAt = A * cla::Transpose(A);
+  static_assert(AAt(0, 1) == 32 && AAt(1, 1) == 77, "Mat * Mat is evaluated at compile time");
+
+  // agrees with the general product
+  cla::Matrix<double> B (2, 3, {1, 2, 3,
+                                4, 5, 6});
+  cla::Matrix<double> BBt = B * cla::Matrix<double>(cla::Transpose(A));
+  cla::Mat<2, 2> D = AAt - BBt;
+  std::cout << "Mat * Mat - Matrix * Matrix: " << std::endl << D << std::endl;
+}
+
+// error of y against A*x computed entry by entry
+template <cla::ORDERING ORD, typename TY, typename TX>
+double matvecerror(cla::Matrix<double, ORD> & A, TY y, TX x, double alpha)
+{
+  double err = 0;
+  for (size_t i = 0; i < A.height(); i++)
+    {
+      double sum = 0;
+      for (size_t k = 0; k < A.width(); k++)
+        sum += A(i, k) * x(k);
+      err = std::max(err, std::abs(y(i) - alpha*sum));
+    }
+  return err;
+}
+
+// matrix-vector products (see matvec.h) for both orderings, strided vectors and expressions
+template <cla::ORDERING ORD>
+void matvec_tests(){
+  double err = 0;
+  for (size_t h : {1, 3, 7, 64, 333})
+    for (size_t w : {1, 5, 8, 129, 1031})
+      {
+        cla::Matrix<double, ORD> A = cla::randommatrix<ORD>(h, w);
+        cla::Vector<double> x(w), ys(2*h), xs(3*w);
+        for (size_t k = 0; k < w; k++)
+          x(k) = xs(3*k+1) = std::sin(k);
+        cla::Vector<double> y = A*x;
+        err = std::max(err, matvecerror(A, y.View(), x.View(), 1));
+
+        // strided y and x, scaled matrix, update
+        auto yv = ys.Slice(0, 2);
+        auto xv = xs.Slice(1, 3);
+        yv = 0.0;
+        yv -= 2.0*A * xv;
+        err = std::max(err, matvecerror(A, yv, x.View(), -2));
+        yv += (2.0*A) * xv;
+        err = std::max(err, matvecerror(A, yv, x.View(), 0));
+
+        // vector expression as factor
+        y = A*(x+x);
+        err = std::max(err, matvecerror(A, y.View(), x.View(), 2));
+      }
+
+  // y overlapping x: goes through a temporary
+  size_t n = 100;
+  cla::Matrix<double, ORD> A = cla::randommatrix<ORD>(n, n);
+  cla::Vector<double> x(n), y(n);
+  for (size_t k = 0; k < n; k++)
+    x(k) = y(k) = 1.0/(k+1);
+  y = A*y;
+  err = std::max(err, matvecerror(A, y.View(), x.View(), 1));
+
+  std::cout << (ORD == cla::RowMajor ? "RowMajor" : "ColMajor") << " A*x: max error " << err << std::endl;
+
+  // kernel against the entry-by-entry evaluation of the expression
+  for (size_t n : {32, 256, 2048})
+    {
+      cla::Matrix<double, ORD> A = cla::randommatrix<ORD>(n, n);
+      cla::Vector<double> x(n), y(n), z(n);
+      for (size_t k = 0; k < n; k++)
+        x(k) = 1.0/(k+1);
+      size_t runs = 200000000 / (n*n) + 1;
+
+      auto start = std::chrono::high_resolution_clock::now();
+      for (size_t r = 0; r < runs; r++)
+        y = A*x;
+      auto end = std::chrono::high_resolution_clock::now();
+      double tkernel = std::chrono::duration<double>(end-start).count();
+
+      auto prod = A*x;
+      start = std::chrono::high_resolution_clock::now();
+      for (size_t r = 0; r < runs; r++)
+        for (size_t i = 0; i < n; i++)
+          z(i) = prod(i);
+      end = std::chrono::high_resolution_clock::now();
+      double tentries = std::chrono::duration<double>(end-start).count();
+
+      std::cout << "n = " << n << ": kernel " << 2.0*n*n*runs/tkernel*1e-9 << " GFlops, entry by entry "
+                << 2.0*n*n*runs/tentries*1e-9 << " GFlops, difference " << cla::L2Norm(y-z) << std::endl;
+    }
+}
+
+// products without the kernels registered by fastmult.h and matvec.h are evaluated entry by entry
+void unregistered_tests(){
+  cla::Matrix<double, cla::ColMajor> A = cla::randommatrix<cla::ColMajor>(37, 21);
+  cla::Matrix<double> B = cla::randommatrix<>(21, 13);
+  cla::Vector<double> x(13);
+  for (size_t k = 0; k < 13; k++)
+    x(k) = std::cos(k);
+  cla::Matrix<double> C = 2.0*A*B, AtA = A.transposed()*A;
+  cla::Vector<double> y = C*x;
+
+  cla::KernelDispatch routes = cla::KernelRoutes();
+  cla::KernelRoutes() = cla::KernelDispatch();
+  cla::Matrix<double> D = 2.0*A*B, AtAentries = A.transposed()*A;
+  cla::Vector<double> z = D*x;
+  cla::KernelRoutes() = routes;
+
+  double err = 0;
+  for (size_t i = 0; i < C.height(); i++)
+    for (size_t j = 0; j < C.width(); j++)
+      err = std::max(err, std::abs(C(i, j) - D(i, j)));
+  for (size_t i = 0; i < AtA.height(); i++)
+    for (size_t j = 0; j < AtA.width(); j++)
+      err = std::max(err, std::abs(AtA(i, j) - AtAentries(i, j)));
+  std::cout << "kernels against entry by entry: max difference " << std::max(err, cla::L2Norm(y-z)) << std::endl;
 }
 
 int main()
@@ -142,14 +316,19 @@ try{
   
 
   misc_tests();
+  fixed_size_tests();
   // expr_tests();
-  // inverse_tests();
+  inverse_tests();
+  matvec_tests<cla::RowMajor>();
+  matvec_tests<cla::ColMajor>();
+  unregistered_tests();
   return 0;
   // TODO test Matrix(const MatrixExpr<TB> & B)
   // TODO test output stream operator
 }
 catch (const std::exception & err){
   std::cerr << "\033[31;1;4;5mERROR CAUGHT: " << err.what() << "\033[0m" << std::endl;
+  return 1;
 }
 
 }
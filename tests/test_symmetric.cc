@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "matrix.h"
+#include "symmetric.h"
+
+using namespace Neo_CLA;
+using namespace std;
+
+// a numerical error above the tolerance fails the test
+void checkerror(const char * what, double err, double tol)
+{
+  if (!(err <= tol))
+    {
+      ostringstream msg;
+      msg << what << ": error " << err << " above tolerance " << tol;
+      throw runtime_error(msg.str());
+    }
+}
+
+// C = alpha*A*B^T (+ alpha*B*A^T) + beta*C0 entry by entry
+template <ORDERING ORDA>
+double reference(Matrix<double, ORDA> & A, Matrix<double, ORDA> & B, double c0, double alpha, double beta,
+                 bool twosided, size_t i, size_t j)
+{
+  double sum = 0;
+  for (size_t k = 0; k < A.width(); k++)
+    sum += A(i, k)*B(j, k) + (twosided ? B(i, k)*A(j, k) : 0);
+  return alpha*sum + beta*c0;
+}
+
+// one triangle is computed, the other one stays untouched (or is mirrored)
+template <ORDERING ORDC, ORDERING ORDA>
+double updatetest(size_t n, size_t k, TRIANGLE tri, bool twosided, bool mirrored)
+{
+  Matrix<double, ORDA> A = randommatrix<ORDA>(n, k, -1, 1), B = randommatrix<ORDA>(n, k, -2, 1);
+  Matrix<double, ORDC> C = randommatrix<ORDC>(n, n), C0 = C;
+  double alpha = 0.5, beta = 2.0;
+
+  if (twosided)
+    multsyr2k(C.View(), A.View(), B.View(), alpha, beta, tri, mirrored);
+  else
+    multsyrk(C.View(), A.View(), alpha, beta, tri, mirrored);
+
+  double err = 0;
+  for (size_t i = 0; i < n; i++)
+    for (size_t j = 0; j < n; j++)
+      {
+        bool stored = (tri == Lower) ? j <= i : j >= i;
+        double expected = stored ? reference(A, twosided ? B : A, C0(i, j), alpha, beta, twosided, i, j)
+          : mirrored ? C(j, i) : C0(i, j);
+        err = max(err, abs(C(i, j) - expected));
+      }
+  return err;
+}
+
+void updatetests()
+{
+  double err = 0;
+  for (size_t n : {1, 5, 37, 300})
+    for (size_t k : {1, 13, 600})
+      for (TRIANGLE tri : {Lower, Upper})
+        for (bool twosided : {false, true})
+          {
+            err = max(err, updatetest<RowMajor, RowMajor>(n, k, tri, twosided, false));
+            err = max(err, updatetest<ColMajor, RowMajor>(n, k, tri, twosided, true));
+            err = max(err, updatetest<RowMajor, ColMajor>(n, k, tri, twosided, true));
+            err = max(err, updatetest<ColMajor, ColMajor>(n, k, tri, twosided, false));
+          }
+  cout << "syrk/syr2k, all orderings and triangles: max error " << err << endl;
+  checkerror("syrk/syr2k", err, 1e-10);
+}
+
+// A^T*A through the expression, against the general product with a copy of A^T
+void gramtests()
+{
+  for (size_t n : {200, 1000, 2000})
+    {
+      Matrix<double> A = randommatrix<>(n, n, -1, 1);
+      Matrix<double, ColMajor> At = A.transposed();
+
+      auto start = chrono::high_resolution_clock::now();
+      Matrix<double> G = A.transposed() * A;
+      auto end = chrono::high_resolution_clock::now();
+      double tsyrk = chrono::duration<double>(end-start).count();
+
+      start = chrono::high_resolution_clock::now();
+      Matrix<double> H = At * A;
+      end = chrono::high_resolution_clock::now();
+      double tgemm = chrono::duration<double>(end-start).count();
+
+      double err = 0, asym = 0;
+      for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j < n; j++)
+          {
+            err = max(err, abs(G(i, j) - H(i, j)));
+            asym = max(asym, abs(G(i, j) - G(j, i)));
+          }
+      cout << "A^T*A, n = " << n << ": syrk " << tsyrk << " s, gemm " << tgemm << " s, difference " << err
+           << ", asymmetry " << asym << endl;
+      checkerror("A^T*A against the general product", err, 1e-8);
+      checkerror("asymmetry of A^T*A", asym, 0);
+    }
+}
+
+// a symmetric matrix in one triangle, the other one holds something else
+void viewtests()
+{
+  size_t n = 301;
+  Matrix<double> A = randommatrix<>(n, n, -1, 1), Ac = A;
+  Matrix<double, ColMajor> B = A;
+  Vector<double> x(n), y(n), z(n), w(n);
+  for (size_t i = 0; i < n; i++)
+    x(i) = sin(i);
+
+  double err = 0;
+  for (TRIANGLE tri : {Lower, Upper})
+    {
+      SymmetricView S(A.View(), tri);
+      SymmetricView T(B.View(), tri);
+      Matrix<double> D = S;  // dense copy
+      y = S*x;
+      z = D*x;
+      w = T*x;
+      err = max(err, L2Norm(y-z) + L2Norm(w-z));
+
+      // with a scaled and an expression factor
+      y = (3.0*S)*(x+x);
+      err = max(err, L2Norm(y - 6.0*z));
+
+      // mirroring makes the storage the full matrix
+      Matrix<double> E = A;
+      SymmetricView(E.View(), tri).Mirror();
+      for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j < n; j++)
+          err = max(err, abs(E(i, j) - D(i, j)));
+    }
+
+  // the products only read the triangle
+  for (size_t i = 0; i < n; i++)
+    for (size_t j = 0; j < n; j++)
+      err = max(err, abs(A(i, j) - Ac(i, j)));
+  cout << "SymmetricView * x: max error " << err << endl;
+  checkerror("SymmetricView * x", err, 1e-10);
+}
+
+int main()
+{
+  try
+    {
+      updatetests();
+      viewtests();
+      gramtests();
+    }
+  catch (const exception & err)
+    {
+      cerr << "ERROR CAUGHT: " << err.what() << endl;
+      return 1;
+    }
+  return 0;
+}
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "matrix.h"
+#include "triangular.h"
+
+using namespace Neo_CLA;
+using namespace std;
+
+// a numerical error above the tolerance fails the test
+void checkerror(const char * what, double err, double tol)
+{
+  if (!(err <= tol))
+    {
+      ostringstream msg;
+      msg << what << ": error " << err << " above tolerance " << tol;
+      throw runtime_error(msg.str());
+    }
+}
+
+// well conditioned also with a unit diagonal, the other triangle holds garbage which must not be read
+template <ORDERING ORD>
+Matrix<double, ORD> trianglematrix(size_t n)
+{
+  Matrix<double, ORD> T = randommatrix<ORD>(n, n, -1, 1);
+  T *= 1.0/n;
+  for (size_t i = 0; i < n; i++)
+    T(i, i) += 2;
+  return T;
+}
+
+template <typename TM>
+double maxdiff(const TM & A, const TM & B)
+{
+  double err = 0;
+  for (size_t i = 0; i < A.height(); i++)
+    for (size_t j = 0; j < A.width(); j++)
+      err = max(err, abs(A(i, j) - B(i, j)));
+  return err;
+}
+
+// the solve and the product from both sides against the dense copy of the view
+template <ORDERING ORDT, ORDERING ORDB>
+double tritest(size_t n, size_t m, TRIANGLE tri, bool unit)
+{
+  Matrix<double, ORDT> A = trianglematrix<ORDT>(n), Ac = A;
+  TriangularView T(A.View(), tri, unit);
+  Matrix<double, ORDB> D = T;
+  Matrix<double, ORDB> B = randommatrix<ORDB>(n, m, -1, 1), X = B, Y = B;
+  Matrix<double, ORDB> C = randommatrix<ORDB>(m, n, -1, 1), Z = C, W = C;
+  double alpha = 0.5;
+
+  multtrsm(T, X.View(), alpha);  // T X = alpha B
+  multtrmm(T, Y.View(), alpha);  // Y = alpha T B
+  multtrsm(Z.View(), T, alpha);  // Z T = alpha C
+  multtrmm(W.View(), T, alpha);  // W = alpha C T
+
+  Matrix<double, ORDB> TX = D*X, TY = D*B, ZT = Z*D, CT = C*D;
+  Matrix<double, ORDB> aB = alpha*B, aC = alpha*C, aTY = alpha*TY, aCT = alpha*CT;
+  return max({maxdiff(TX, aB), maxdiff(Y, aTY), maxdiff(ZT, aC), maxdiff(W, aCT), maxdiff(A, Ac)});
+}
+
+void tritests()
+{
+  double err = 0;
+  for (size_t n : {1, 7, 64, 65, 300})
+    for (size_t m : {1, 17, 301})
+      for (TRIANGLE tri : {Lower, Upper})
+        for (bool unit : {false, true})
+          {
+            err = max(err, tritest<RowMajor, RowMajor>(n, m, tri, unit));
+            err = max(err, tritest<RowMajor, ColMajor>(n, m, tri, unit));
+            err = max(err, tritest<ColMajor, RowMajor>(n, m, tri, unit));
+            err = max(err, tritest<ColMajor, ColMajor>(n, m, tri, unit));
+          }
+  cout << "trsm/trmm, all orderings, triangles and sides: max error " << err << endl;
+  checkerror("trsm/trmm", err, 1e-12);
+}
+
+// forward substitution with n right-hand sides against the product with the dense triangle
+void timings()
+{
+  for (size_t n : {256, 1000, 2000})
+    {
+      Matrix<double> A = trianglematrix<RowMajor>(n);
+      TriangularView L(A.View(), Lower);
+      Matrix<double> D = L, B = randommatrix<>(n, n, -1, 1), X = B;
+
+      auto start = chrono::high_resolution_clock::now();
+      multtrsm(L, X.View());
+      auto end = chrono::high_resolution_clock::now();
+      double tsolve = chrono::duration<double>(end-start).count();
+
+      start = chrono::high_resolution_clock::now();
+      Matrix<double> P = D*X;
+      end = chrono::high_resolution_clock::now();
+      double tgemm = chrono::duration<double>(end-start).count();
+
+      // the solve has half the flops of the product
+      cout << "n = " << n << ": trsm " << n*n*double(n) / tsolve * 1e-9 << " GFlops, gemm "
+           << 2*n*n*double(n) / tgemm * 1e-9 << " GFlops, residual " << maxdiff(P, B) << endl;
+      checkerror("trsm residual", maxdiff(P, B), 1e-12);
+    }
+}
+
+int main()
+{
+  try
+    {
+      tritests();
+      timings();
+    }
+  catch (const exception & err)
+    {
+      cerr << "ERROR CAUGHT: " << err.what() << endl;
+      return 1;
+    }
+  return 0;
+}
@@ -1,4 +1,10 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
 #include <iostream>
+#include <type_traits>
+#include <vector>
 
 #include <vector.h>
 
@@ -37,6 +43,205 @@ int main()
 
   x.Range(2,6) = cla::Vector({1, 2, 0, 4});
   std::cout << "x = " << x << std::endl;
+
+  // storage is 64-byte aligned
+  cla::Vector<double> a(13);
+  cla::Vector<double, cla::PoolAllocator<double>> b(13);
+  std::cout << "alignment: " << reinterpret_cast<uintptr_t>(a.Data()) % 64 << ", "
+            << reinterpret_cast<uintptr_t>(b.Data()) % 64 << " (should be 0, 0)" << std::endl;
+
+  // move assignment takes over the buffer instead of copying
+  const double * bdata = b.Data();
+  cla::Vector<double, cla::PoolAllocator<double>> c(7);
+  c = std::move(b);
+  if (c.Data() != bdata || c.Size() != 13)
+    {
+      std::cerr << "move assignment copied the vector" << std::endl;
+      return 1;
+    }
+
+  // temporaries of a time-stepping loop, with and without pool
+  auto timestepping = [](auto proto, const char * name){
+    typedef decltype(proto) VEC;
+    size_t n = 20, steps = 1000000;
+    VEC u(n);
+    u = 1;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t step = 0; step < steps; step++)
+    {
+      VEC k1 = 1e-6*u;
+      VEC k2 = u + 0.5*k1;
+      u = u + 1e-6*k2;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << name << ": " << std::chrono::duration<double>(end-start).count() << " s, u(0) = " << u(0) << std::endl;
+  };
+  timestepping(cla::Vector<double>(1), "aligned allocator");
+  timestepping(cla::Vector<double, cla::PoolAllocator<double>>(1), "pool allocator");
+  std::cout << "cached blocks: " << cla::SizeClassPool::Local().Cached() << std::endl;
+
+  // axpy: SIMD packets for unit-stride vectors, element by element for strided views
+  {
+    size_t n = 1000000, runs = 200;
+    cla::Vector<double> u(n+1), w(n+1);
+    u = 1;
+    w = 2;
+    auto axpy = [&](auto uv, auto wv, const char * name){
+      auto start = std::chrono::high_resolution_clock::now();
+      for (size_t r = 0; r < runs; r++)
+        uv += 1e-3*wv - 1e-3*uv;
+      auto end = std::chrono::high_resolution_clock::now();
+      double time = std::chrono::duration<double>(end-start).count();
+      std::cout << name << ": " << 3*n*runs*sizeof(double)/time*1e-9 << " GB/s" << std::endl;
+    };
+    axpy(u.Range(0, n), w.Range(0, n), "axpy, packets");
+    axpy(u.Range(1, n+1), w.Range(1, n+1), "axpy, packets, unaligned");
+    axpy(u.Slice(0, 1), w.Slice(0, 1), "axpy, strided");
+
+    cla::Vector<double> x(7), y(7);
+    for (size_t i = 0; i < 7; i++)
+      {
+        x(i) = i;
+        y(i) = 1;
+      }
+    x -= 2*y + x;
+    std::cout << "-2-x = " << x << std::endl;
+  }
+
+  // deep expressions: nodes hold views of the vectors, and are not copied when evaluated
+  {
+    size_t n = 1000, runs = 100000;
+    cla::Vector<double> a(n), b(n), c(n), d(n), u(n);
+    a = 1; b = 2; c = 3; d = 4;
+
+    auto expr = a + 2*b - 3*c + d;
+    static_assert(std::is_reference<decltype(expr.Upcast())>::value, "Upcast must not copy the node");
+    static_assert(sizeof(expr) <= 4*sizeof(cla::VectorView<double>) + 2*sizeof(double), "expression must hold views only");
+    std::cout << "sizeof(a + 2*b - 3*c + d) = " << sizeof(expr) << std::endl;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t r = 0; r < runs; r++)
+      u = a + 2*b - 3*c + d;
+    auto end = std::chrono::high_resolution_clock::now();
+    double texpr = std::chrono::duration<double>(end-start).count();
+
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t r = 0; r < runs; r++)
+      for (size_t i = 0; i < n; i++)
+        u(i) = a(i) + 2*b(i) - 3*c(i) + d(i);
+    end = std::chrono::high_resolution_clock::now();
+    double tloop = std::chrono::duration<double>(end-start).count();
+
+    std::cout << "a + 2*b - 3*c + d: expression " << texpr << " s, hand-written loop " << tloop << " s, u(0) = " << u(0) << std::endl;
+  }
+
+  // several updates in one pass over memory
+  {
+    size_t n = 4000000, runs = 20;
+    double h = 1e-3, a = 0.5, b = 0.25;
+    cla::Vector<double> y(n), z(n), w(n), k1(n), k2(n);
+    y = 1; z = 2; k1 = 3; k2 = 4;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t r = 0; r < runs; r++)
+      {
+        y = y + h*k1;
+        z = z - h*k2;
+        w = a*y + b*z;
+      }
+    auto end = std::chrono::high_resolution_clock::now();
+    double tsep = std::chrono::duration<double>(end-start).count();
+    double wsep = w(n-1);
+
+    y = 1; z = 2;
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t r = 0; r < runs; r++)
+      cla::Fused(cla::Assign(y, y + h*k1),
+                 cla::SubAssign(z, h*k2),
+                 cla::Assign(w, a*y + b*z));
+    end = std::chrono::high_resolution_clock::now();
+    double tfused = std::chrono::duration<double>(end-start).count();
+
+    std::cout << "RK update: separate " << tsep << " s, fused " << tfused << " s, speedup " << tsep/tfused
+              << ", difference " << w(n-1) - wsep << std::endl;
+  }
+
+  // fixed-size vectors: unrolled, no heap memory and usable at compile time
+  {
+    constexpr cla::Vec<3> a(1, 2, 3), b(4, 5, 6);
+    constexpr cla::Vec<3> c = a + 2.0*b;
+    static_assert(c(2) == 15, "Vec expressions are evaluated at compile time");
+    static_assert(sizeof(cla::Vec<3>) == 4*sizeof(double), "Vec<3> is padded to a full packet");
+
+    // particles in a field: x += h*v, v -= h*x for many small vectors
+    size_t np = 10000, steps = 500;
+    double h = 1e-3;
+    std::vector<cla::Vec<3>> xf(np, cla::Vec<3>(1, 0, 0)), vf(np, cla::Vec<3>(0, 1, 0));
+    std::vector<cla::Vector<double>> xd(np, cla::Vector<double>(3)), vd(np, cla::Vector<double>(3));
+    for (size_t p = 0; p < np; p++)
+      {
+        xd[p] = 0; xd[p](0) = 1;
+        vd[p] = 0; vd[p](1) = 1;
+      }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t s = 0; s < steps; s++)
+      for (size_t p = 0; p < np; p++)
+        {
+          xf[p] += h*vf[p];
+          vf[p] -= h*xf[p];
+        }
+    auto end = std::chrono::high_resolution_clock::now();
+    double tfixed = std::chrono::duration<double>(end-start).count();
+
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t s = 0; s < steps; s++)
+      for (size_t p = 0; p < np; p++)
+        {
+          xd[p] += h*vd[p];
+          vd[p] -= h*xd[p];
+        }
+    end = std::chrono::high_resolution_clock::now();
+    double tdyn = std::chrono::duration<double>(end-start).count();
+
+    std::cout << "3-vectors: Vec " << tfixed << " s, Vector " << tdyn << " s, speedup " << tdyn/tfixed
+              << ", difference " << xf[0](0) - xd[0](0) << std::endl;
+  }
+
+  // large vectors are processed by all threads of the task pool
+  {
+    size_t n = 10000003;
+    cla::Vector<double> u(n), w(n);
+    for (size_t i = 0; i < n; i++)
+      {
+        u(i) = 1.0/(i+1);
+        w(i) = std::sin(i);
+      }
+
+    for (bool reproducible : {false, true})
+      {
+        cla::ReproducibleReductions() = reproducible;
+        std::cout << (reproducible ? "reproducible:" : "fastest:") << std::endl;
+        for (size_t threads : {1, 2, 3, 4})
+          {
+            cla::SetNumThreads(threads);
+            auto start = std::chrono::high_resolution_clock::now();
+            double dot = u*w;
+            auto end = std::chrono::high_resolution_clock::now();
+            std::cout << "  " << threads << " threads: u*w = " << std::setprecision(17) << dot << std::setprecision(6) << ", "
+                      << 2*n*sizeof(double)/std::chrono::duration<double>(end-start).count()*1e-9 << " GB/s" << std::endl;
+          }
+      }
+    cla::ReproducibleReductions() = false;
+
+    u = 2*w - u;
+    u += u;
+    u /= 2;
+    double err = 0;
+    for (size_t i = 0; i < n; i++)
+      err = std::max(err, std::abs(u(i) - (2*std::sin(i) - 1.0/(i+1))));
+    std::cout << "parallel assignment, max error: " << err << std::endl;
+  }
 }
 
 
@@ -0,0 +1,204 @@
+// Finds the fastest micro-kernel and block sizes for multpacked and multparallel on this machine,
+// and the sizes from which x*y and A*x are faster by ddot and dgemv, and writes them to a GEMM profile (see gemmprofile.h). Programs use it
+// after LoadGemmProfile(path), or if the environment variable NEO_CLA_GEMM_PROFILE names it.
+//
+// usage: tune_fastmult [matrix size = 1000] [profile file = DefaultGemmProfilePath()]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "fastmult.h"
+#include "lapack_interface.h"
+#include "matrix.h"
+
+
+using namespace Neo_CLA;
+using namespace std;
+
+// GFlops of func, best of three runs
+template <typename FUNC>
+double gflops(size_t n, FUNC func)
+{
+  double best = 1e99;
+  for (int run = 0; run < 3; run++)
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    func();
+    auto end = std::chrono::high_resolution_clock::now();
+    best = std::min(best, std::chrono::duration<double>(end-start).count());
+  }
+  return double(n)*n*n/(best*1e9);
+}
+
+// seconds per call of func, best of three rounds of reps calls
+template <typename FUNC>
+double seconds(size_t reps, FUNC func)
+{
+  double best = 1e99;
+  for (int run = 0; run < 3; run++)
+  {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t r = 0; r < reps; r++)
+      func();
+    auto end = std::chrono::high_resolution_clock::now();
+    best = std::min(best, std::chrono::duration<double>(end-start).count() / reps);
+  }
+  return best;
+}
+
+// the shortest length from which ddot is faster than the native Dot for all longer vectors,
+// size_t(-1) if Dot is faster for the longest one
+size_t tune_dot()
+{
+  std::vector<size_t> lengths = {16, 64, 256, 1024, 4096, 16384, 65536, 1 << 18, 1 << 20, 1 << 22};
+  size_t threshold = size_t(-1);
+  volatile double sink = 0;
+  for (auto it = lengths.rbegin(); it != lengths.rend(); ++it)
+  {
+    size_t n = *it;
+    Vector<double> x(n), y(n);
+    for (size_t i = 0; i < n; i++)
+    {
+      x(i) = 1.0/(i+1);
+      y(i) = i % 7;
+    }
+    size_t reps = (size_t(1) << 24) / n + 1;
+
+    BlasRoutes().dot_threshold = size_t(-1);
+    double tnative = seconds(reps, [&](){ sink = sink + x*y; });
+    BlasRoutes().dot_threshold = 0;
+    double tblas = seconds(reps, [&](){ sink = sink + x*y; });
+    std::cout << "x*y, n = " << n << ": Dot " << 2*n/tnative*1e-9 << " GFlops, ddot " << 2*n/tblas*1e-9
+              << " GFlops" << std::endl;
+
+    if (tblas >= tnative) break;
+    threshold = n;
+  }
+  BlasRoutes().dot_threshold = threshold;
+  return threshold;
+}
+
+// the number of entries of A from which dgemv is faster than multgemv for all larger matrices,
+// for both orderings together; size_t(-1) if multgemv is faster for the largest one
+size_t tune_gemv()
+{
+  std::vector<size_t> sizes = {8, 16, 32, 64, 128, 256, 512, 1024, 2048};
+  size_t threshold = size_t(-1);
+  for (auto it = sizes.rbegin(); it != sizes.rend(); ++it)
+  {
+    size_t n = *it;
+    Matrix<double, RowMajor> A = randommatrix<RowMajor>(n, n);
+    Matrix<double, ColMajor> AC = A;
+    Vector<double> x(n), y(n);
+    for (size_t i = 0; i < n; i++)
+      x(i) = 1.0/(i+1);
+    size_t reps = (size_t(1) << 24) / (n*n) + 1;
+
+    BlasRoutes().gemv_threshold = size_t(-1);
+    double tnative = seconds(reps, [&](){ y = A*x; }) + seconds(reps, [&](){ y = AC*x; });
+    BlasRoutes().gemv_threshold = 0;
+    double tblas = seconds(reps, [&](){ y = A*x; }) + seconds(reps, [&](){ y = AC*x; });
+    std::cout << "A*x, n = " << n << ": multgemv " << 4*n*n/tnative*1e-9 << " GFlops, dgemv "
+              << 4*n*n/tblas*1e-9 << " GFlops" << std::endl;
+
+    if (tblas >= tnative) break;
+    threshold = n*n;
+  }
+  BlasRoutes().gemv_threshold = threshold;
+  return threshold;
+}
+
+// coordinate search: every parameter is swept once, keeping the best value of the previous ones
+double tune_blocking(size_t n, GemmBlocking & blocks, Matrix<> & C, Matrix<> & A, Matrix<> & B)
+{
+  double best = 0;
+  auto sweep = [&](size_t GemmBlocking::* param, std::vector<size_t> values){
+    for (size_t value : values)
+    {
+      GemmBlocking trial = blocks;
+      trial.*param = value;
+      double gf = gflops(n, [&](){ multpacked(C, A, B, 1.0, trial); });
+      if (gf > best)
+      {
+        best = gf;
+        blocks = trial;
+      }
+    }
+  };
+
+  sweep(&GemmBlocking::kc, {128, 192, 256, 320, 384, 512});
+  sweep(&GemmBlocking::mc, {48, 72, 96, 120, 144, 192, 240});
+  sweep(&GemmBlocking::nc, {1024, 2048, 3072, 4096, 8192});
+  return best;
+}
+
+
+int main (int argc, char ** argv){
+
+  size_t n = argc > 1 ? std::atoi(argv[1]) : 1000;
+  std::string path = argc > 2 ? argv[2] : DefaultGemmProfilePath();
+
+  Matrix<> A = randommatrix<>(n, n);
+  Matrix<> B = randommatrix<>(n, n);
+  Matrix<> C (n, n);
+  C = 0;
+
+  GemmProfile best;
+  double bestgf = 0;
+
+  for (const MicroKernel & kernel : AvailableMicroKernels())
+  {
+    SetMicroKernel(kernel.name);
+    GemmBlocking blocks;
+    double gf = tune_blocking(n, blocks, C, A, B);
+
+    std::cout << kernel.name << ": mc = " << blocks.mc << ", kc = " << blocks.kc << ", nc = " << blocks.nc
+              << ", GFlops: " << gf << std::endl;
+
+    if (gf > bestgf)
+    {
+      bestgf = gf;
+      best.kernel = kernel.name;
+      best.blocks = blocks;
+    }
+  }
+
+  // the tile width only matters for multparallel
+  SetMicroKernel(best.kernel);
+  if (NumThreads() > 1)
+  {
+    double besttw = 0;
+    size_t tw = best.blocks.tw;
+    for (size_t trial : {128, 192, 256, 384, 512, 768, 1024})
+    {
+      GemmBlocking blocks = best.blocks;
+      blocks.tw = trial;
+      SetGemmDefaults(blocks);
+      double gf = gflops(n, [&](){ multparallel(C, A, B); });
+      std::cout << "multparallel with " << NumThreads() << " threads, tw = " << trial << ": GFlops: " << gf << std::endl;
+      if (gf > besttw)
+      {
+        besttw = gf;
+        tw = trial;
+      }
+    }
+    best.blocks.tw = tw;
+  }
+
+  best.dot_threshold = tune_dot();
+  best.gemv_threshold = tune_gemv();
+
+  WriteGemmProfile(path, best);
+  std::cout << "best: " << best.kernel << " with mc = " << best.blocks.mc << ", kc = " << best.blocks.kc
+            << ", nc = " << best.blocks.nc << ", tw = " << best.blocks.tw << " (" << bestgf << " GFlops)" << std::endl
+            << "x*y by ddot " << (*best.dot_threshold == size_t(-1) ? std::string("never")
+                                  : "from length " + std::to_string(*best.dot_threshold))
+            << ", A*x by dgemv " << (*best.gemv_threshold == size_t(-1) ? std::string("never")
+                                     : "from " + std::to_string(*best.gemv_threshold) + " entries") << std::endl
+            << "written to " << path << ", use it with LoadGemmProfile(path) or NEO_CLA_GEMM_PROFILE=" << path << std::endl;
+
+  return 0;
+}